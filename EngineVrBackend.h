@@ -0,0 +1,210 @@
+#pragma once
+#include <WickedEngine.h>
+#include "wiGraphicsDevice_DX12.h"
+#include "wiGraphicsDevice_Vulkan.h"
+
+#include "openvr.h"
+
+//Submit path to the compositor. The backend is chosen once at session start,
+//render() then makes a single call per frame without knowing which graphics API is running.
+class EngineVrSubmitter
+{
+public:
+	enum SLOT
+	{
+		SLOT_LEFT_EYE,
+		SLOT_RIGHT_EYE,
+		//two slots per overlay layer, one for each of its textures
+		SLOT_OVERLAY,
+		SLOT_COUNT = SLOT_OVERLAY + 16
+	};
+
+	virtual ~EngineVrSubmitter() = default;
+
+	virtual const char* getName() const = 0;
+	//compositor texture for a slot, rebuilt only when the texture behind the slot changes
+	virtual bool describe(uint32_t slot, const wi::graphics::Texture& texture, vr::Texture_t& vrTexture) = 0;
+	virtual void submit(const wi::graphics::Texture& left, const wi::graphics::Texture& right) = 0;
+
+	uint64_t getSubmittedFrames() const { return submittedFrames; }
+	uint64_t getDescriptorRebuilds() const { return descriptorRebuilds; }
+
+protected:
+	uint64_t submittedFrames = 0;
+	uint64_t descriptorRebuilds = 0;
+};
+
+//Backend policies: how a texture is described to OpenVR, and whether there is a compositor to hand it to
+
+struct EngineVrBackendNull
+{
+	//no runtime behind it, used for replay and to run the whole frame loop without a headset
+	struct Descriptor
+	{
+		struct
+		{
+			uint32_t width = 0;
+			uint32_t height = 0;
+		} data;
+	};
+
+	static constexpr const char* name = "Null";
+	static constexpr bool usesCompositor = false;
+	static constexpr vr::ETextureType textureType = vr::TextureType_Invalid;
+
+	bool init() { return true; }
+
+	void describe(const wi::graphics::Texture& texture, Descriptor& descriptor)
+	{
+		descriptor.data.width = texture.desc.width;
+		descriptor.data.height = texture.desc.height;
+	}
+};
+
+#ifdef WICKEDENGINE_BUILD_DX12
+struct EngineVrBackendDX12
+{
+	struct Descriptor
+	{
+		vr::D3D12TextureData_t data = {};
+	};
+
+	static constexpr const char* name = "DX12";
+	static constexpr bool usesCompositor = true;
+	static constexpr vr::ETextureType textureType = vr::TextureType_DirectX12;
+
+	wi::graphics::GraphicsDevice_DX12* device = nullptr;
+
+	bool init()
+	{
+		device = dynamic_cast<wi::graphics::GraphicsDevice_DX12*>(wi::graphics::GetDevice());
+		return device != nullptr;
+	}
+
+	void describe(const wi::graphics::Texture& texture, Descriptor& descriptor)
+	{
+		descriptor.data.m_pResource = device->GetTextureInternalResource(&texture);
+		descriptor.data.m_pCommandQueue = device->GetGraphicsCommandQueue();
+		descriptor.data.m_nNodeMask = 0;
+	}
+};
+#endif // WICKEDENGINE_BUILD_DX12
+
+#ifdef WICKEDENGINE_BUILD_VULKAN
+struct EngineVrBackendVulkan
+{
+	struct Descriptor
+	{
+		vr::VRVulkanTextureData_t data = {};
+	};
+
+	static constexpr const char* name = "Vulkan";
+	static constexpr bool usesCompositor = true;
+	static constexpr vr::ETextureType textureType = vr::TextureType_Vulkan;
+
+	wi::graphics::GraphicsDevice_Vulkan* device = nullptr;
+
+	bool init()
+	{
+		device = dynamic_cast<wi::graphics::GraphicsDevice_Vulkan*>(wi::graphics::GetDevice());
+		return device != nullptr;
+	}
+
+	static VkFormat convertFormat(wi::graphics::Format format)
+	{
+		switch (format)
+		{
+		case wi::graphics::Format::R8G8B8A8_UNORM_SRGB: return VK_FORMAT_R8G8B8A8_SRGB;
+		case wi::graphics::Format::B8G8R8A8_UNORM: return VK_FORMAT_B8G8R8A8_UNORM;
+		case wi::graphics::Format::B8G8R8A8_UNORM_SRGB: return VK_FORMAT_B8G8R8A8_SRGB;
+		case wi::graphics::Format::R10G10B10A2_UNORM: return VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+		case wi::graphics::Format::R16G16B16A16_FLOAT: return VK_FORMAT_R16G16B16A16_SFLOAT;
+		default: return VK_FORMAT_R8G8B8A8_UNORM;
+		}
+	}
+
+	void describe(const wi::graphics::Texture& texture, Descriptor& descriptor)
+	{
+		descriptor.data.m_nImage = (uint64_t)device->GetTextureInternalResource(&texture);
+		descriptor.data.m_pDevice = device->GetDevice();
+		descriptor.data.m_pPhysicalDevice = device->GetPhysicalDevice();
+		descriptor.data.m_pInstance = device->GetInstance();
+		descriptor.data.m_pQueue = device->GetGraphicsCommandQueue();
+		descriptor.data.m_nQueueFamilyIndex = device->GetGraphicsFamilyIndex();
+		descriptor.data.m_nWidth = texture.desc.width;
+		descriptor.data.m_nHeight = texture.desc.height;
+		descriptor.data.m_nFormat = convertFormat(texture.desc.format);
+		descriptor.data.m_nSampleCount = texture.desc.sample_count;
+	}
+};
+#endif // WICKEDENGINE_BUILD_VULKAN
+
+template<typename Backend>
+class EngineVrSubmitterT final : public EngineVrSubmitter
+{
+public:
+	bool init()
+	{
+		return backend.init();
+	}
+
+	const char* getName() const override
+	{
+		return Backend::name;
+	}
+
+	bool describe(uint32_t slot, const wi::graphics::Texture& texture, vr::Texture_t& vrTexture) override
+	{
+		if (slot >= SLOT_COUNT || !texture.IsValid())
+			return false;
+
+		Cache& cache = caches[slot];
+		if (cache.texture.internal_state != texture.internal_state)
+		{
+			//holding the texture keeps its resource (and address) alive while the descriptor refers to it
+			cache.texture = texture;
+			backend.describe(texture, cache.descriptor);
+			cache.vrTexture = { (void*)&cache.descriptor.data, Backend::textureType, vr::ColorSpace_Gamma };
+			descriptorRebuilds++;
+		}
+
+		vrTexture = cache.vrTexture;
+		return true;
+	}
+
+	void submit(const wi::graphics::Texture& left, const wi::graphics::Texture& right) override
+	{
+		vr::Texture_t leftEyeTexture;
+		vr::Texture_t rightEyeTexture;
+		bool hasLeft = describe(SLOT_LEFT_EYE, left, leftEyeTexture);
+		bool hasRight = describe(SLOT_RIGHT_EYE, right, rightEyeTexture);
+
+		if constexpr (Backend::usesCompositor)
+		{
+			static const vr::VRTextureBounds_t bounds = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+			if (hasLeft)
+			{
+				vr::VRCompositor()->Submit(vr::Eye_Left, &leftEyeTexture, &bounds, vr::Submit_Default);
+			}
+			if (hasRight)
+			{
+				vr::VRCompositor()->Submit(vr::Eye_Right, &rightEyeTexture, &bounds, vr::Submit_Default);
+			}
+			vr::VRCompositor()->PostPresentHandoff();
+		}
+
+		submittedFrames++;
+	}
+
+private:
+	struct Cache
+	{
+		wi::graphics::Texture texture;
+		typename Backend::Descriptor descriptor;
+		vr::Texture_t vrTexture = {};
+	};
+
+	Backend backend;
+	Cache caches[SLOT_COUNT];
+};
@@ -0,0 +1,173 @@
+#include "WickedEngine.h"
+#include "EngineVrInput.h"
+#include <filesystem>
+
+static const char* digitalActionPaths[EngineVrInput::HAND_COUNT][EngineVrInput::DIGITAL_COUNT] =
+{
+	{ "/actions/main/in/trigger_left", "/actions/main/in/grip_left", "/actions/main/in/primary_left", "/actions/main/in/secondary_left" },
+	{ "/actions/main/in/trigger_right", "/actions/main/in/grip_right", "/actions/main/in/primary_right", "/actions/main/in/secondary_right" },
+};
+
+static const char* padActionPaths[EngineVrInput::HAND_COUNT] = { "/actions/main/in/pad_left", "/actions/main/in/pad_right" };
+static const char* poseActionPaths[EngineVrInput::HAND_COUNT] = { "/actions/main/in/pose_left", "/actions/main/in/pose_right" };
+
+//legacy button ids of each digital action, as read by getControllerActions
+static const vr::EVRButtonId legacyButtons[EngineVrInput::DIGITAL_COUNT] =
+{
+	vr::k_EButton_SteamVR_Trigger,
+	vr::k_EButton_Grip,
+	vr::k_EButton_A,
+	vr::k_EButton_ApplicationMenu
+};
+
+bool EngineVrInput::init(vr::IVRInput* value, const std::string& manifestPath)
+{
+	shutdown();
+
+	if (value == nullptr)
+		return false;
+
+	std::error_code error;
+	std::string fullPath = std::filesystem::absolute(manifestPath, error).string();
+	if (error || value->SetActionManifestPath(fullPath.c_str()) != vr::VRInputError_None)
+	{
+		wi::backlog::post("VR action manifest not loaded: " + manifestPath, wi::backlog::LogLevel::Error);
+		return false;
+	}
+
+	bool valid = value->GetActionSetHandle("/actions/main", &mainSet) == vr::VRInputError_None;
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
+	{
+		for (int action = 0; action < DIGITAL_COUNT; ++action)
+		{
+			valid = valid && value->GetActionHandle(digitalActionPaths[hand][action], &digitalActions[hand][action]) == vr::VRInputError_None;
+		}
+		valid = valid && value->GetActionHandle(padActionPaths[hand], &padActions[hand]) == vr::VRInputError_None;
+		valid = valid && value->GetActionHandle(poseActionPaths[hand], &poseActions[hand]) == vr::VRInputError_None;
+	}
+
+	if (!valid)
+	{
+		wi::backlog::post("VR action manifest is missing actions: " + manifestPath, wi::backlog::LogLevel::Error);
+		return false;
+	}
+
+	input = value;
+	activeSets[0] = {};
+	activeSets[0].ulActionSet = mainSet;
+	activeSets[0].ulRestrictedToDevice = vr::k_ulInvalidInputValueHandle;
+	activeSetCount = 1;
+	return true;
+}
+
+void EngineVrInput::shutdown()
+{
+	input = nullptr;
+	mainSet = vr::k_ulInvalidActionSetHandle;
+	activeSetCount = 0;
+	state = State();
+}
+
+bool EngineVrInput::isInitialized() const
+{
+	return input != nullptr;
+}
+
+bool EngineVrInput::setActionSetActive(const char* actionSet, bool active)
+{
+	if (input == nullptr)
+		return false;
+
+	vr::VRActionSetHandle_t handle = vr::k_ulInvalidActionSetHandle;
+	if (input->GetActionSetHandle(actionSet, &handle) != vr::VRInputError_None || handle == mainSet)
+		return false;
+
+	for (uint32_t i = 1; i < activeSetCount; ++i)
+	{
+		if (activeSets[i].ulActionSet == handle)
+		{
+			if (!active)
+			{
+				activeSets[i] = activeSets[--activeSetCount];
+			}
+			return true;
+		}
+	}
+
+	if (!active)
+		return true;
+
+	if (activeSetCount == maxActionSets)
+		return false;
+
+	vr::VRActiveActionSet_t& set = activeSets[activeSetCount++];
+	set = {};
+	set.ulActionSet = handle;
+	set.ulRestrictedToDevice = vr::k_ulInvalidInputValueHandle;
+	return true;
+}
+
+bool EngineVrInput::update()
+{
+	if (input == nullptr)
+		return false;
+
+	if (input->UpdateActionState(activeSets, sizeof(vr::VRActiveActionSet_t), activeSetCount) != vr::VRInputError_None)
+		return false;
+
+	//reads below come from the state the runtime just sent, no round trip per action
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
+	{
+		HandState& handState = state.hands[hand];
+
+		for (int action = 0; action < DIGITAL_COUNT; ++action)
+		{
+			vr::InputDigitalActionData_t data = {};
+			bool valid = input->GetDigitalActionData(digitalActions[hand][action], &data, sizeof(data), vr::k_ulInvalidInputValueHandle) == vr::VRInputError_None;
+			handState.digital[action] = valid && data.bActive && data.bState;
+		}
+
+		vr::InputAnalogActionData_t analog = {};
+		if (input->GetAnalogActionData(padActions[hand], &analog, sizeof(analog), vr::k_ulInvalidInputValueHandle) == vr::VRInputError_None && analog.bActive)
+		{
+			handState.pad = XMFLOAT2(analog.x, analog.y);
+		}
+		else
+		{
+			handState.pad = XMFLOAT2(0, 0);
+		}
+
+		vr::InputPoseActionData_t pose = {};
+		handState.poseValid = input->GetPoseActionDataForNextFrame(poseActions[hand], vr::TrackingUniverseStanding, &pose, sizeof(pose), vr::k_ulInvalidInputValueHandle) == vr::VRInputError_None &&
+			pose.bActive && pose.pose.bPoseIsValid;
+		if (handState.poseValid)
+		{
+			handState.pose = pose.pose.mDeviceToAbsoluteTracking;
+		}
+	}
+
+	state.updateCount++;
+	return true;
+}
+
+const EngineVrInput::State& EngineVrInput::getState() const
+{
+	return state;
+}
+
+void EngineVrInput::writeControllerState(HAND hand, vr::VRControllerState_t& controllerState) const
+{
+	const HandState& handState = state.hands[hand];
+
+	controllerState = {};
+	controllerState.unPacketNum = (uint32_t)state.updateCount;
+	for (int action = 0; action < DIGITAL_COUNT; ++action)
+	{
+		if (handState.digital[action])
+		{
+			controllerState.ulButtonPressed |= vr::ButtonMaskFromId(legacyButtons[action]);
+		}
+	}
+	controllerState.rAxis[0].x = handState.pad.x;
+	controllerState.rAxis[0].y = handState.pad.y;
+}
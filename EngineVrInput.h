@@ -0,0 +1,69 @@
+#pragma once
+#include <WickedEngine.h>
+
+#include "openvr.h"
+
+//Input through IVRInput action manifests (input/actions.json) instead of the legacy controller states.
+//One UpdateActionState per frame covers every active action set, the actions are then read
+//into a state block owned by this class, so nothing is allocated or queried per device.
+//Any vr::IVRInput implementation can be given to init(), a mock one included.
+class EngineVrInput
+{
+public:
+	enum HAND
+	{
+		HAND_LEFT,
+		HAND_RIGHT,
+		HAND_COUNT
+	};
+
+	enum DIGITAL_ACTION
+	{
+		DIGITAL_TRIGGER,
+		DIGITAL_GRIP,
+		DIGITAL_PRIMARY,//X on the left hand, A on the right hand
+		DIGITAL_SECONDARY,//Y on the left hand, B on the right hand
+		DIGITAL_COUNT
+	};
+
+	struct HandState
+	{
+		bool digital[DIGITAL_COUNT] = {};
+		XMFLOAT2 pad = XMFLOAT2(0, 0);
+		bool poseValid = false;
+		vr::HmdMatrix34_t pose = {};
+	};
+
+	struct State
+	{
+		HandState hands[HAND_COUNT];
+		uint64_t updateCount = 0;
+	};
+
+	static const uint32_t maxActionSets = 4;
+
+	//manifestPath may be relative, the runtime is given the absolute path
+	bool init(vr::IVRInput* value, const std::string& manifestPath);
+	void shutdown();
+	bool isInitialized() const;
+
+	//the main set (/actions/main) is always active, other sets of the manifest can be added
+	bool setActionSetActive(const char* actionSet, bool active);
+
+	//once per frame, false when the runtime refused the update (the previous state is kept)
+	bool update();
+	const State& getState() const;
+
+	//same buttons and axis as the legacy API, so recording, replay and isButtonX() stay on one path
+	void writeControllerState(HAND hand, vr::VRControllerState_t& state) const;
+
+private:
+	vr::IVRInput* input = nullptr;
+	vr::VRActionSetHandle_t mainSet = vr::k_ulInvalidActionSetHandle;
+	vr::VRActionHandle_t digitalActions[HAND_COUNT][DIGITAL_COUNT] = {};
+	vr::VRActionHandle_t padActions[HAND_COUNT] = {};
+	vr::VRActionHandle_t poseActions[HAND_COUNT] = {};
+	vr::VRActiveActionSet_t activeSets[maxActionSets] = {};
+	uint32_t activeSetCount = 0;
+	State state;
+};
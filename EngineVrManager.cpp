@@ -2,10 +2,22 @@
 #include "WickedEngine.h"
 #include "EngineVrManager.h"
 #include <algorithm>
+#include <cstring>
 
 EngineVrManager* EngineVrManager::instance = nullptr;
 
-EngineVrManager::EngineVrManager(){}
+//Offset from the controller pose to the hand model (and to the pick ray origin)
+static const XMFLOAT4 gripRotationLeft = XMFLOAT4(-0.7071f, 0.7071f, 0.0f, 0.0f);
+static const XMFLOAT4 gripRotationRight = XMFLOAT4(0.7071f, 0.7071f, 0.0f, 0.0f);
+static const XMFLOAT3 gripTranslationLeft = XMFLOAT3(0.01f, 0.02f, -0.09f);
+static const XMFLOAT3 gripTranslationRight = XMFLOAT3(-0.01f, 0.02f, -0.09f);
+
+EngineVrManager::EngineVrManager()
+{
+	//grip offsets are applied with one multiply per hand and frame
+	XMStoreFloat4x4(&handGripOffset[HAND_LEFT], XMMatrixRotationQuaternion(XMLoadFloat4(&gripRotationLeft)) * XMMatrixTranslationFromVector(XMLoadFloat3(&gripTranslationLeft)));
+	XMStoreFloat4x4(&handGripOffset[HAND_RIGHT], XMMatrixRotationQuaternion(XMLoadFloat4(&gripRotationRight)) * XMMatrixTranslationFromVector(XMLoadFloat3(&gripTranslationRight)));
+}
 
 EngineVrManager::~EngineVrManager() {};
 
@@ -16,19 +28,17 @@ void EngineVrManager::startVrSession(wi::scene::Scene& scene)
 	//Disable VSync
 	wi::eventhandler::SetVSync(false);
 
-	if (dynamic_cast<wi::graphics::GraphicsDevice_DX12*>(wi::graphics::GetDevice()))
-	{
-		dx12 = true;
-	}
+	//replay has no runtime to ask for render models, it keeps the hands
+	controllerModelsActive = controllerModelsEnabled && !replay.isOpen();
 
-	if (rightHand == wi::ecs::INVALID_ENTITY)
+	if (rightHand == wi::ecs::INVALID_ENTITY && !controllerModelsActive)
 	{
 		wi::scene::LoadModel(scene, "hands/right.wiscene");
 		rightHand = scene.Entity_FindByName("RightHand");
 		
 	}
 
-	if (leftHand == wi::ecs::INVALID_ENTITY)
+	if (leftHand == wi::ecs::INVALID_ENTITY && !controllerModelsActive)
 	{
 		wi::scene::LoadModel(scene, "hands/left.wiscene");
 		leftHand = scene.Entity_FindByName("LeftHand");
@@ -43,44 +53,104 @@ void EngineVrManager::startVrSession(wi::scene::Scene& scene)
 	//Get the transformation of camera for moving VR
 	cameraTransform.world = wi::scene::GetCamera().InvView;
 
-	//loading openVR runtime
-	vr::EVRInitError error = vr::VRInitError_None;
-	hmd = vr::VR_Init(&error, vr::VRApplication_Scene);
-	if (error != vr::VRInitError_None)
+	if (replay.isOpen())
 	{
-		wi::backlog::post("Failed to init VR runtime.", wi::backlog::LogLevel::Error);
+		//headless replay, everything the runtime would report comes from the recording
+		const VrRecordHeader& header = replay.getHeader();
+		widthTexture = header.width;
+		heightTexture = header.height;
+		if (header.displayFrequency > 0.0f)
+		{
+			frameBudgetMs = 1000.0f / header.displayFrequency;
+		}
+		memcpy(projectionRaw, header.projectionRaw, sizeof(projectionRaw));
+		mat4eyePosLeft = ConvertSteamVRMatrixToXMMATRIX(header.getEyeToHead(vr::Eye_Left));
+		mat4eyePosRight = ConvertSteamVRMatrixToXMMATRIX(header.getEyeToHead(vr::Eye_Right));
+		replayFrameIndex = 0;
 	}
-
-	renderModels = (vr::IVRRenderModels*)vr::VR_GetGenericInterface(vr::IVRRenderModels_Version, &error);
-	if (!renderModels)
+	else
 	{
-		stopVrSession();
-		return;
-	}
+		//loading openVR runtime
+		vr::EVRInitError error = vr::VRInitError_None;
+		hmd = vr::VR_Init(&error, vr::VRApplication_Scene);
+		if (error != vr::VRInitError_None)
+		{
+			wi::backlog::post("Failed to init VR runtime.", wi::backlog::LogLevel::Error);
+		}
+
+		renderModels = (vr::IVRRenderModels*)vr::VR_GetGenericInterface(vr::IVRRenderModels_Version, &error);
+		if (!renderModels)
+		{
+			stopVrSession();
+			return;
+		}
+
+		if (controllerModelsActive)
+		{
+			controllerModels.setScene(&scene);
+			controllerModels.setCacheDirectory(controllerModelCacheDirectory);
+			controllerModels.setProvider(std::make_shared<EngineVrRuntimeRenderModelProvider>(renderModels));
+		}
+
+		if (vr::VROverlay() != nullptr)
+		{
+			overlays.setApi(std::make_shared<EngineVrRuntimeOverlayApi>(vr::VROverlay()));
+		}
+
+		actionInputActive = false;
+		if (inputBackend == INPUT_ACTIONS)
+		{
+			actionInputActive = input.init(vr::VRInput(), actionManifestPath);
+			if (!actionInputActive)
+			{
+				wi::backlog::post("VR action input not available, using the legacy controller states", wi::backlog::LogLevel::Warning);
+			}
+		}
 
-	std::string m_strDriver = "No Driver";
-	std::string m_strDisplay = "No Display";
+		std::string_view m_strDriver = "No Driver";
+		std::string_view m_strDisplay = "No Display";
 
-	m_strDriver = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_TrackingSystemName_String);
-	m_strDisplay = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SerialNumber_String);
+		m_strDriver = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_TrackingSystemName_String);
+		m_strDisplay = GetTrackedDeviceString(hmd, vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SerialNumber_String);
 
-	hmd->GetRecommendedRenderTargetSize(&widthTexture, &heightTexture);
+		hmd->GetRecommendedRenderTargetSize(&widthTexture, &heightTexture);
 
-	mat4ProjectionLeft = GetHMDMatrixProjectionEye(vr::Eye_Left);
-	mat4ProjectionRight = GetHMDMatrixProjectionEye(vr::Eye_Right);
-	mat4eyePosLeft = GetHMDMatrixPoseEye(vr::Eye_Left);
-	mat4eyePosRight = GetHMDMatrixPoseEye(vr::Eye_Right);
+		float displayFrequency = hmd->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float);
+		if (displayFrequency > 0.0f)
+		{
+			frameBudgetMs = 1000.0f / displayFrequency;
+		}
 
-	if (!vr::VRCompositor())
-	{
-		wi::backlog::post("Compositor initialization failed.\n", wi::backlog::LogLevel::Error);
+		for (int nEye = vr::Eye_Left; nEye <= vr::Eye_Right; ++nEye)
+		{
+			hmd->GetProjectionRaw((vr::Hmd_Eye)nEye, &projectionRaw[nEye][0], &projectionRaw[nEye][1], &projectionRaw[nEye][2], &projectionRaw[nEye][3]);
+		}
+
+		mat4eyePosLeft = GetHMDMatrixPoseEye(vr::Eye_Left);
+		mat4eyePosRight = GetHMDMatrixPoseEye(vr::Eye_Right);
+
+		if (!vr::VRCompositor())
+		{
+			wi::backlog::post("Compositor initialization failed.\n", wi::backlog::LogLevel::Error);
+		}
 	}
 
+	//center eye is the midpoint between both eyes, used for the far field
+	mat4eyePosCenter = mat4eyePosLeft;
+	mat4eyePosCenter.r[3] = XMVectorLerp(mat4eyePosLeft.r[3], mat4eyePosRight.r[3], 0.5f);
+
+	updateProjections();
+	createSubmitter();
+
+	vrFrameIndex = 0;
 	isVrRunning = true;
 }
 
 void EngineVrManager::stopVrSession()
 {
+	handAnimation[HAND_LEFT] = wi::ecs::INVALID_ENTITY;
+	handAnimation[HAND_RIGHT] = wi::ecs::INVALID_ENTITY;
+
 	if (leftHand != wi::ecs::INVALID_ENTITY)
 	{
 		sceneVR->Entity_Remove(leftHand, true);
@@ -93,6 +163,22 @@ void EngineVrManager::stopVrSession()
 		rightHand = wi::ecs::INVALID_ENTITY;
 	}
 
+	recorder.stop();
+	streaming.clear();
+	controllerModels.clear();
+	input.shutdown();
+	actionInputActive = false;
+	overlays.setApi(nullptr);
+	controllerModelDevice[HAND_LEFT] = -1;
+	controllerModelDevice[HAND_RIGHT] = -1;
+	submitter.reset();
+	for (int i = 0; i < 2; ++i)
+	{
+		resizeTargets[i] = RenderTarget();
+		compositeTargets[i] = RenderTarget();
+	}
+	streamingRigValid = false;
+
 	isVrRunning = false;
 	if (hmd != nullptr)
 	{
@@ -121,6 +207,54 @@ void EngineVrManager::stopVrSession()
 		wi::scene::GetScene().Entity_Remove(cameraEntityRight, true);
 		cameraEntityRight = wi::ecs::INVALID_ENTITY;
 	}
+
+	if (wi::scene::GetScene().cameras.GetComponent(cameraEntityCenter) != nullptr)
+	{
+		wi::scene::GetScene().Entity_Remove(cameraEntityCenter, true);
+	}
+	cameraEntityCenter = wi::ecs::INVALID_ENTITY;
+
+	if (wi::scene::GetScene().cameras.GetComponent(cameraEntitySpectator) != nullptr)
+	{
+		wi::scene::GetScene().Entity_Remove(cameraEntitySpectator, true);
+	}
+	cameraEntitySpectator = wi::ecs::INVALID_ENTITY;
+	spectatorTexture = nullptr;
+	spectatorDeferredFrames = 0;
+	spectatorPhase = SPECTATOR_WAIT;
+}
+
+//The graphics API is resolved once here, the per frame submit goes straight to the matching backend
+void EngineVrManager::createSubmitter()
+{
+	submitter.reset();
+
+	if (!replay.isOpen())
+	{
+#ifdef WICKEDENGINE_BUILD_DX12
+		auto submitterDx12 = std::make_unique<EngineVrSubmitterT<EngineVrBackendDX12>>();
+		if (submitterDx12->init())
+		{
+			submitter = std::move(submitterDx12);
+			return;
+		}
+#endif // WICKEDENGINE_BUILD_DX12
+
+#ifdef WICKEDENGINE_BUILD_VULKAN
+		auto submitterVulkan = std::make_unique<EngineVrSubmitterT<EngineVrBackendVulkan>>();
+		if (submitterVulkan->init())
+		{
+			submitter = std::move(submitterVulkan);
+			return;
+		}
+#endif // WICKEDENGINE_BUILD_VULKAN
+
+		wi::backlog::post("No VR submit backend for this graphics device, frames will not reach the compositor.", wi::backlog::LogLevel::Warning);
+	}
+
+	auto submitterNull = std::make_unique<EngineVrSubmitterT<EngineVrBackendNull>>();
+	submitterNull->init();
+	submitter = std::move(submitterNull);
 }
 
 void EngineVrManager::createVrCameras()
@@ -154,48 +288,142 @@ void EngineVrManager::createVrCameras()
 		renderPathRight.resolutionScale = 0.75f;
 		renderPathRight.ResizeBuffers();
 	}
+
+	if (hybridMono)
+	{
+		createFarFieldCamera();
+	}
+}
+
+void EngineVrManager::createFarFieldCamera()
+{
+	if (cameraEntityCenter == wi::ecs::INVALID_ENTITY || wi::scene::GetScene().cameras.GetComponent(cameraEntityCenter) == nullptr)
+	{
+		cameraEntityCenter = wi::ecs::CreateEntity();
+		wi::scene::CameraComponent* cameraCenter = &wi::scene::GetScene().cameras.Create(cameraEntityCenter);
+
+		//same resolution as the eyes so the far image can be composited without filtering differences
+		renderPathCenter.scene = &wi::scene::GetScene();
+		cameraCenter->width = (float)widthTexture;
+		cameraCenter->height = (float)heightTexture;
+		renderPathCenter.camera = cameraCenter;
+		renderPathCenter.width = widthTexture;
+		renderPathCenter.height = heightTexture;
+		renderPathCenter.resolutionScale = renderPathLeft.resolutionScale;
+		renderPathCenter.ResizeBuffers();
+	}
+}
+
+void EngineVrManager::createSpectatorCamera()
+{
+	if (cameraEntitySpectator == wi::ecs::INVALID_ENTITY || wi::scene::GetScene().cameras.GetComponent(cameraEntitySpectator) == nullptr)
+	{
+		cameraEntitySpectator = wi::ecs::CreateEntity();
+		wi::scene::GetScene().cameras.Create(cameraEntitySpectator);
+		renderPathSpectator.width = 0;
+		renderPathSpectator.height = 0;
+	}
+
+	wi::scene::CameraComponent* cameraSpectator = wi::scene::GetScene().cameras.GetComponent(cameraEntitySpectator);
+	renderPathSpectator.scene = &wi::scene::GetScene();
+	renderPathSpectator.camera = cameraSpectator;
+
+	if (renderPathSpectator.width != spectatorWidth || renderPathSpectator.height != spectatorHeight)
+	{
+		cameraSpectator->width = (float)spectatorWidth;
+		cameraSpectator->height = (float)spectatorHeight;
+		renderPathSpectator.width = spectatorWidth;
+		renderPathSpectator.height = spectatorHeight;
+		renderPathSpectator.ResizeBuffers();
+		spectatorTexture = nullptr;
+	}
+}
+
+void EngineVrManager::updateProjections()
+{
+	if (hybridMono)
+	{
+		//eyes only see the near field, the center eye starts where they stop
+		mat4ProjectionLeft = GetHMDMatrixProjectionEye(vr::Eye_Left, 0.1f, farFieldSplitDistance);
+		mat4ProjectionRight = GetHMDMatrixProjectionEye(vr::Eye_Right, 0.1f, farFieldSplitDistance);
+		mat4ProjectionCenter = GetHMDMatrixProjectionCenter(farFieldSplitDistance, 1000.0f);
+		updateFarFieldCrop();
+	}
+	else
+	{
+		mat4ProjectionLeft = GetHMDMatrixProjectionEye(vr::Eye_Left);
+		mat4ProjectionRight = GetHMDMatrixProjectionEye(vr::Eye_Right);
+	}
+}
+
+bool EngineVrManager::updateVrCamera(wi::ecs::Entity cameraEntity, const XMMATRIX& projectionMatrix, const XMMATRIX& eyePos)
+{
+	wi::scene::CameraComponent* cameraVR = wi::scene::GetScene().cameras.GetComponent(cameraEntity);
+	if (cameraVR == nullptr)
+	{
+		return false;
+	}
+
+	XMFLOAT4X4 mpj;
+	XMStoreFloat4x4(&mpj, projectionMatrix);
+
+	cameraVR->SetCustomProjectionEnabled(true);
+	cameraVR->Projection = mpj;
+	cameraVR->TransformCamera(eyePos * mat4HMDPose * XMLoadFloat4x4(&cameraTransform.world));
+	cameraVR->UpdateCamera();
+	cameraVR->SetDirty();
+	return true;
 }
 
 void EngineVrManager::updateVrSession(float dt)
 {
-	if (isVrRunning && hmd != nullptr)
+	if (isVrRunning && (hmd != nullptr || replay.isOpen()))
 	{
 		createVrCameras();
 
-		// Process controller state
-		for (vr::TrackedDeviceIndex_t unDevice = 0; unDevice < vr::k_unMaxTrackedDeviceCount; unDevice++)
+		if (replay.isOpen())
 		{
-			vr::VRControllerState_t state;
-			if (hmd->GetControllerState(unDevice, &state, sizeof(state)))
-			{
-				getControllerActions(state, unDevice, dt);
-			}
+			if (!readReplayFrame())
+				return;
 		}
+		else
+		{
+			readLiveFrame(dt);
+		}
+
+		recorder.push(inputFrame);
 
-		//Update HMD pose
-		vr::EVRCompositorError compError = vr::VRCompositor()->WaitGetPoses(trackedDevicePose, vr::k_unMaxTrackedDeviceCount, NULL, 0);
-		if (compError != vr::VRCompositorError_None)
+		// Process controller state, the getters then read it until the next frame
+		controllerVR.axis = XMFLOAT2(0.0f, 0.0f);
+		controllerVR.butonState = false;
+		controllerVR.controller = CONTROLLER::NONE;
+		controllerVR.controllerDir = CONTROLLER::NONE;
+		for (uint32_t i = 0; i < inputFrame.deviceCount; ++i)
 		{
-			wi::backlog::post("Error waiting for compositor pose", wi::backlog::LogLevel::Error);
+			const VrRecordDevice& device = inputFrame.devices[i];
+			if (device.hasState)
+			{
+				getControllerActions(device.getState(), (vr::ETrackedControllerRole)device.role, dt);
+			}
 		}
 
 		int leftIndex = -1;
 		int rightIndex = -1;
 
-		for (int nDevice = 0; nDevice < vr::k_unMaxTrackedDeviceCount; ++nDevice)
+		for (uint32_t i = 0; i < inputFrame.deviceCount; ++i)
 		{
+			const VrRecordDevice& device = inputFrame.devices[i];
+			int nDevice = (int)device.index;
+
 			if (trackedDevicePose[nDevice].bPoseIsValid)
 			{
-				if (!hmd->IsTrackedDeviceConnected(nDevice))
-					continue;
-
 				mat4DevicePose[nDevice] = ConvertSteamVRMatrixToXMMATRIX(trackedDevicePose[nDevice].mDeviceToAbsoluteTracking);
 
-				vr::ETrackedDeviceClass tDeviceClass = hmd->GetTrackedDeviceClass(nDevice);
+				vr::ETrackedDeviceClass tDeviceClass = (vr::ETrackedDeviceClass)device.deviceClass;
 
 				if (tDeviceClass == vr::TrackedDeviceClass_Controller || tDeviceClass == vr::TrackedDeviceClass_GenericTracker)
 				{
-					vr::ETrackedControllerRole role = hmd->GetControllerRoleForTrackedDeviceIndex(nDevice);
+					vr::ETrackedControllerRole role = (vr::ETrackedControllerRole)device.role;
 
 					if (role == vr::TrackedControllerRole_LeftHand)
 					{
@@ -208,38 +436,6 @@ void EngineVrManager::updateVrSession(float dt)
 							rightIndex = nDevice;
 						}
 					}
-
-					if (rightIndex >= 0 && trackedDevicePose[rightIndex].bPoseIsValid && sceneVR != nullptr)
-					{
-						vr::HmdMatrix34_t mat = trackedDevicePose[rightIndex].mDeviceToAbsoluteTracking;
-						wi::scene::TransformComponent* rightHandTransform = sceneVR->transforms.GetComponent(rightHand);
-						if (rightHandTransform != nullptr)
-						{
-							rightHandTransform->ClearTransform();
-							rightHandTransform->Rotate(XMFLOAT4(0.7071f, 0.7071f, 0.0f, 0.0f));
-							rightHandTransform->Translate(XMFLOAT3(-0.01f, 0.02f, -0.09f));
-							rightHandTransform->UpdateTransform();
-							XMMATRIX controllerPose = ConvertSteamVRMatrixToXMMATRIX(mat) * XMLoadFloat4x4(&cameraTransform.world);
-							rightHandTransform->MatrixTransform(controllerPose);
-							rightHandTransform->UpdateTransform();
-						}
-					}
-
-					if (leftIndex >= 0 && trackedDevicePose[leftIndex].bPoseIsValid && sceneVR != nullptr)
-					{
-						vr::HmdMatrix34_t mat = trackedDevicePose[leftIndex].mDeviceToAbsoluteTracking;
-						wi::scene::TransformComponent* leftHandTransform = sceneVR->transforms.GetComponent(leftHand);
-						if (leftHandTransform != nullptr)
-						{
-							leftHandTransform->ClearTransform();
-							leftHandTransform->Rotate(XMFLOAT4(-0.7071f, 0.7071f, 0.0f, 0.0f));
-							leftHandTransform->Translate(XMFLOAT3(0.01f,0.02f,-0.09f));
-							leftHandTransform->UpdateTransform();
-							XMMATRIX controllerPose = ConvertSteamVRMatrixToXMMATRIX(mat) * XMLoadFloat4x4(&cameraTransform.world);
-							leftHandTransform->MatrixTransform(controllerPose);
-							leftHandTransform->UpdateTransform();
-						}
-					}
 				}
 			}
 		}
@@ -249,6 +445,23 @@ void EngineVrManager::updateVrSession(float dt)
 			mat4HMDPose = mat4DevicePose[vr::k_unTrackedDeviceIndex_Hmd];
 		}
 
+		updateHands(leftIndex, rightIndex);
+		animateVrHands(dt);
+		triggerHeld[HAND_LEFT] = false;
+		triggerHeld[HAND_RIGHT] = false;
+
+		updateControllerRays(leftIndex, rightIndex);
+
+		if (controllerModelsActive)
+		{
+			updateControllerModels(leftIndex, rightIndex);
+		}
+
+		if (streaming.isEnabled())
+		{
+			updateStreaming(dt);
+		}
+
 		////capture steamVR events here
 		//vr::VREvent_t event;
 		//while (hmd->PollNextEvent(&event, sizeof(event))) 
@@ -277,16 +490,192 @@ void EngineVrManager::updateVrSession(float dt)
 	}
 }
 
-void EngineVrManager::getControllerActions(vr::VRControllerState_t state, int unDevice, float dt)
+//Pick rays start at the grip offset and point along the controller forward axis
+void EngineVrManager::updateControllerRays(int leftIndex, int rightIndex)
+{
+	int deviceIndex[HAND_COUNT] = { leftIndex, rightIndex };
+	const XMFLOAT3* gripTranslation[HAND_COUNT] = { &gripTranslationLeft, &gripTranslationRight };
+
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
+	{
+		controllerRayValid[hand] = deviceIndex[hand] >= 0 && trackedDevicePose[deviceIndex[hand]].bPoseIsValid;
+		if (!controllerRayValid[hand])
+			continue;
+
+		XMMATRIX controllerPose = mat4DevicePose[deviceIndex[hand]] * XMLoadFloat4x4(&cameraTransform.world);
+		XMVECTOR origin = XMVector3Transform(XMLoadFloat3(gripTranslation[hand]), controllerPose);
+		XMVECTOR direction = XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), controllerPose));
+		controllerRays[hand] = wi::primitive::Ray(origin, direction, 0.0f, controllerRayLength);
+	}
+
+	//poses changed, every cached hit is stale
+	rayCacheCount = 0;
+}
+
+//Render model names are only queried when the device behind a hand changes, loading itself never waits
+void EngineVrManager::updateControllerModels(int leftIndex, int rightIndex)
+{
+	int deviceIndex[HAND_COUNT] = { leftIndex, rightIndex };
+
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
+	{
+		if (deviceIndex[hand] != controllerModelDevice[hand])
+		{
+			controllerModelDevice[hand] = deviceIndex[hand];
+			if (deviceIndex[hand] >= 0 && hmd != nullptr)
+			{
+				controllerModels.setSlotModel(hand, GetTrackedDeviceString(hmd, deviceIndex[hand], vr::Prop_RenderModelName_String));
+			}
+		}
+	}
+
+	controllerModels.update();
+
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
+	{
+		wi::scene::TransformComponent* transform = sceneVR->transforms.GetComponent(controllerModels.getSlotEntity(hand));
+		if (transform != nullptr && deviceIndex[hand] >= 0 && trackedDevicePose[deviceIndex[hand]].bPoseIsValid)
+		{
+			transform->ClearTransform();
+			transform->MatrixTransform(mat4DevicePose[deviceIndex[hand]] * XMLoadFloat4x4(&cameraTransform.world));
+			transform->UpdateTransform();
+		}
+	}
+}
+
+//Predicted position is the HMD in world space moved by its tracked velocity plus the rig movement (cameraTransform)
+void EngineVrManager::updateStreaming(float dt)
+{
+	XMMATRIX world = XMLoadFloat4x4(&cameraTransform.world);
+
+	XMVECTOR rigPosition = world.r[3];
+	XMVECTOR rigVelocity = XMVectorZero();
+	if (dt > 0.0f && streamingRigValid)
+	{
+		rigVelocity = XMVectorScale(XMVectorSubtract(rigPosition, XMLoadFloat3(&streamingRigPosition)), 1.0f / dt);
+	}
+	XMStoreFloat3(&streamingRigPosition, rigPosition);
+	streamingRigValid = true;
+
+	const vr::HmdVector3_t& velocity = trackedDevicePose[vr::k_unTrackedDeviceIndex_Hmd].vVelocity;
+	XMVECTOR hmdVelocity = XMVector3TransformNormal(XMVectorSet(velocity.v[0], velocity.v[1], -velocity.v[2], 0.0f), world);
+
+	XMFLOAT3 position;
+	XMFLOAT3 predictedVelocity;
+	XMStoreFloat3(&position, XMVector3Transform(XMVectorZero(), mat4HMDPose * world));
+	XMStoreFloat3(&predictedVelocity, XMVectorAdd(hmdVelocity, rigVelocity));
+
+	streaming.update(position, predictedVelocity, dt);
+}
+
+//Fill inputFrame from the runtime: connected devices, their controller state and the poses for this frame
+void EngineVrManager::readLiveFrame(float dt)
+{
+	inputFrame.frameIndex = vrFrameIndex++;
+	inputFrame.dt = dt;
+	inputFrame.deviceCount = 0;
+
+	//the frame has room for every device index, only what the session uses is kept and recorded (no base stations)
+	for (vr::TrackedDeviceIndex_t unDevice = 0; unDevice < vr::k_unMaxTrackedDeviceCount; unDevice++)
+	{
+		if (!hmd->IsTrackedDeviceConnected(unDevice))
+			continue;
+
+		vr::ETrackedDeviceClass deviceClass = hmd->GetTrackedDeviceClass(unDevice);
+		if (deviceClass != vr::TrackedDeviceClass_HMD && deviceClass != vr::TrackedDeviceClass_Controller && deviceClass != vr::TrackedDeviceClass_GenericTracker)
+			continue;
+
+		VrRecordDevice& device = inputFrame.devices[inputFrame.deviceCount++];
+		device = VrRecordDevice();
+		device.index = unDevice;
+		device.deviceClass = deviceClass;
+		device.role = hmd->GetControllerRoleForTrackedDeviceIndex(unDevice);
+
+		//with an action manifest loaded the legacy states are empty, they are filled from the actions below
+		vr::VRControllerState_t state;
+		if (!actionInputActive && hmd->GetControllerState(unDevice, &state, sizeof(state)))
+		{
+			device.setState(state);
+			device.hasState = 1;
+		}
+	}
+
+	//Update HMD pose
+	vr::EVRCompositorError compError = vr::VRCompositor()->WaitGetPoses(trackedDevicePose, vr::k_unMaxTrackedDeviceCount, NULL, 0);
+	if (compError != vr::VRCompositorError_None)
+	{
+		wi::backlog::post("Error waiting for compositor pose", wi::backlog::LogLevel::Error);
+	}
+
+	for (uint32_t i = 0; i < inputFrame.deviceCount; ++i)
+	{
+		inputFrame.devices[i].setPose(trackedDevicePose[inputFrame.devices[i].index]);
+	}
+
+	//one runtime update for every action, then written as legacy states so recording and replay see the same data
+	if (actionInputActive && input.update())
+	{
+		for (uint32_t i = 0; i < inputFrame.deviceCount; ++i)
+		{
+			VrRecordDevice& device = inputFrame.devices[i];
+			if (device.role == vr::TrackedControllerRole_LeftHand || device.role == vr::TrackedControllerRole_RightHand)
+			{
+				EngineVrInput::HAND hand = device.role == vr::TrackedControllerRole_LeftHand ? EngineVrInput::HAND_LEFT : EngineVrInput::HAND_RIGHT;
+				vr::VRControllerState_t state;
+				input.writeControllerState(hand, state);
+				device.setState(state);
+				device.hasState = 1;
+
+				//the hands follow the pose action (bound to the raw hand pose, so the grip offset still applies)
+				const EngineVrInput::HandState& handState = input.getState().hands[hand];
+				if (handState.poseValid)
+				{
+					vr::TrackedDevicePose_t& pose = trackedDevicePose[device.index];
+					pose.mDeviceToAbsoluteTracking = handState.pose;
+					pose.bPoseIsValid = true;
+					device.setPose(pose);
+				}
+			}
+		}
+	}
+}
+
+//Fill inputFrame and the tracked poses from the recording, returns false once every frame was played
+bool EngineVrManager::readReplayFrame()
+{
+	if (!replay.getFrame(replayFrameIndex, inputFrame))
+		return false;
+
+	replayFrameIndex++;
+
+	for (vr::TrackedDeviceIndex_t unDevice = 0; unDevice < vr::k_unMaxTrackedDeviceCount; unDevice++)
+	{
+		trackedDevicePose[unDevice].bPoseIsValid = false;
+	}
+
+	for (uint32_t i = 0; i < inputFrame.deviceCount; ++i)
+	{
+		if (inputFrame.devices[i].index >= vr::k_unMaxTrackedDeviceCount)
+		{
+			inputFrame.devices[i].index = 0;
+			inputFrame.devices[i].poseIsValid = 0;
+		}
+		trackedDevicePose[inputFrame.devices[i].index] = inputFrame.devices[i].getPose();
+	}
+
+	return true;
+}
+
+void EngineVrManager::getControllerActions(const vr::VRControllerState_t& state, vr::ETrackedControllerRole role, float dt)
 {
 	//touchpad left or right
-	if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_LeftHand || hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_RightHand)
+	if (role == vr::TrackedControllerRole_LeftHand || role == vr::TrackedControllerRole_RightHand)
 	{
-		if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_LeftHand)
+		if (role == vr::TrackedControllerRole_LeftHand)
 		{
 			controllerVR.controllerDir = CONTROLLER::TOUCHPAD_LEFT;
 		}
-		else if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_RightHand)
+		else if (role == vr::TrackedControllerRole_RightHand)
 		{
 			controllerVR.controllerDir = CONTROLLER::TOUCHPAD_RIGHT;
 		}
@@ -312,20 +701,22 @@ void EngineVrManager::getControllerActions(vr::VRControllerState_t state, int un
 		if (state.ulButtonPressed & vr::ButtonMaskFromId((vr::EVRButtonId)33))//Trigger
 		{
 			controllerVR.butonState = true;
-			if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_LeftHand)
+			if (role == vr::TrackedControllerRole_LeftHand)
 			{
 				controllerVR.controller = CONTROLLER::BUTTON_TRIGGER_LEFT;
+				triggerHeld[HAND_LEFT] = true;
 			}
 			else
 			{
 				controllerVR.controller = CONTROLLER::BUTTON_TRIGGER_RIGHT;
+				triggerHeld[HAND_RIGHT] = true;
 			}
 		}
 
 		if (state.ulButtonPressed & vr::ButtonMaskFromId((vr::EVRButtonId)2))//Grip
 		{
 			controllerVR.butonState = true;
-			if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_LeftHand)
+			if (role == vr::TrackedControllerRole_LeftHand)
 			{
 				controllerVR.controller = CONTROLLER::BUTTON_GRIP_LEFT;
 			}
@@ -338,7 +729,7 @@ void EngineVrManager::getControllerActions(vr::VRControllerState_t state, int un
 		if (state.ulButtonPressed & vr::ButtonMaskFromId((vr::EVRButtonId)7))//X,A
 		{
 			controllerVR.butonState = true;
-			if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_LeftHand)
+			if (role == vr::TrackedControllerRole_LeftHand)
 			{
 				controllerVR.controller = CONTROLLER::BUTTON_X;
 			}
@@ -351,7 +742,7 @@ void EngineVrManager::getControllerActions(vr::VRControllerState_t state, int un
 		if (state.ulButtonPressed & vr::ButtonMaskFromId((vr::EVRButtonId)1))//Y,B
 		{
 			controllerVR.butonState = true;
-			if (hmd->GetControllerRoleForTrackedDeviceIndex(unDevice) == vr::TrackedControllerRole_LeftHand)
+			if (role == vr::TrackedControllerRole_LeftHand)
 			{
 				controllerVR.controller = CONTROLLER::BUTTON_Y;
 			}
@@ -376,80 +767,104 @@ void EngineVrManager::getControllerActions(vr::VRControllerState_t state, int un
 	}
 
 	//moveVrFromTouchs(dt);
-	animateVrHands(dt);
-
-	controllerVR.axis.x = 0.0f;
-	controllerVR.axis.y = 0.0f;
-	controllerVR.butonState = false;
-	controllerVR.controller = CONTROLLER::NONE;
-	controllerVR.controllerDir = CONTROLLER::NONE;
 }
 
+//Hand animations stay paused and their timer is driven from the trigger here, so the scene update only samples them when the timer changed.
+//A hand outside both eyes is not sampled at all and a far one at a lower rate, its timer keeps running and is applied when it is back.
 void EngineVrManager::animateVrHands(float dt)
 {
-	if (sceneVR != nullptr)
+	frameStats.handAnimationSamples = 0;
+	frameStats.handAnimationSampleSkips = 0;
+
+	if (sceneVR == nullptr)
+		return;
+
+	const char* animationNames[HAND_COUNT] = { "LeftAnim", "RightAnim" };
+	wi::ecs::Entity handEntity[HAND_COUNT] = { leftHand, rightHand };
+	handLodFrame++;
+
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
 	{
-		wi::ecs::Entity leftAnim = sceneVR->Entity_FindByName("LeftAnim");
-		if (leftAnim != wi::ecs::INVALID_ENTITY)
+		if (handEntity[hand] == wi::ecs::INVALID_ENTITY)
+			continue;
+
+		wi::scene::AnimationComponent* handAnimationComponent = sceneVR->animations.GetComponent(handAnimation[hand]);
+		if (handAnimationComponent == nullptr)
 		{
-			wi::scene::AnimationComponent* leftHandAnimation = sceneVR->animations.GetComponent(leftAnim);
-			if (leftHandAnimation != nullptr)
-			{
-				leftHandAnimation->start = 0.0f;
-				leftHandAnimation->end = 1.0f;
-				leftHandAnimation->speed = 1.5f;
-				leftHandAnimation->Play();
-				leftHandAnimation->SetLooped(false);
+			//looked up by name once, not every frame
+			handAnimation[hand] = sceneVR->Entity_FindByName(animationNames[hand]);
+			handAnimationComponent = sceneVR->animations.GetComponent(handAnimation[hand]);
+			if (handAnimationComponent == nullptr)
+				continue;
+
+			handAnimationComponent->start = 0.0f;
+			handAnimationComponent->end = 1.0f;
+			handAnimationComponent->speed = 1.5f;
+			handAnimationComponent->SetLooped(false);
+			handAnimationComponent->Pause();
+			handAnimationTime[hand] = handAnimationComponent->timer;
+		}
 
-				if (isButtonTriggerLeft())
-				{
-					if (leftHandAnimation->timer < leftHandAnimation->end)
-					{
-						leftHandAnimation->timer += dt * leftHandAnimation->speed; // avancer timer
-						if (leftHandAnimation->timer > leftHandAnimation->end) leftHandAnimation->timer = leftHandAnimation->end;
-					}
-				}
-				else
-				{
-					if (leftHandAnimation->timer > leftHandAnimation->start)
-					{
-						leftHandAnimation->timer -= dt * leftHandAnimation->speed; // reculer timer
-						if (leftHandAnimation->timer < leftHandAnimation->start) leftHandAnimation->timer = leftHandAnimation->start;
-					}
-				}
-			}
+		float step = dt * handAnimationComponent->speed;
+		handAnimationTime[hand] = std::clamp(handAnimationTime[hand] + (triggerHeld[hand] ? step : -step), handAnimationComponent->start, handAnimationComponent->end);
+
+		bool lodSkip = !handVisible[hand] || (!handNear[hand] && handLodFrame % handLodInterval != 0);
+		if (handAnimationTime[hand] == handAnimationComponent->timer || lodSkip)
+		{
+			frameStats.handAnimationSampleSkips++;
+			continue;
 		}
 
-		wi::ecs::Entity rightAnim = sceneVR->Entity_FindByName("RightAnim");
-		if (rightAnim != wi::ecs::INVALID_ENTITY)
+		handAnimationComponent->timer = handAnimationTime[hand];
+		frameStats.handAnimationSamples++;
+	}
+}
+
+//Hands are placed once per frame, after every device was read. Their visibility in the eyes drives the animation LOD
+void EngineVrManager::updateHands(int leftIndex, int rightIndex)
+{
+	if (sceneVR == nullptr)
+		return;
+
+	int deviceIndex[HAND_COUNT] = { leftIndex, rightIndex };
+	wi::ecs::Entity handEntity[HAND_COUNT] = { leftHand, rightHand };
+	XMMATRIX world = XMLoadFloat4x4(&cameraTransform.world);
+	const wi::scene::CameraComponent* eyeCameras[2] = {
+		wi::scene::GetScene().cameras.GetComponent(cameraEntityLeft),
+		wi::scene::GetScene().cameras.GetComponent(cameraEntityRight)
+	};
+
+	for (int hand = 0; hand < HAND_COUNT; ++hand)
+	{
+		handVisible[hand] = false;
+		handNear[hand] = false;
+
+		wi::scene::TransformComponent* handTransform = sceneVR->transforms.GetComponent(handEntity[hand]);
+		if (handTransform == nullptr || deviceIndex[hand] < 0 || !trackedDevicePose[deviceIndex[hand]].bPoseIsValid)
+			continue;
+
+		handTransform->ClearTransform();
+		handTransform->MatrixTransform(XMLoadFloat4x4(&handGripOffset[hand]) * mat4DevicePose[deviceIndex[hand]] * world);
+		handTransform->UpdateTransform();
+
+		XMFLOAT3 position = handTransform->GetPosition();
+		wi::primitive::AABB bounds(
+			XMFLOAT3(position.x - handBoundsRadius, position.y - handBoundsRadius, position.z - handBoundsRadius),
+			XMFLOAT3(position.x + handBoundsRadius, position.y + handBoundsRadius, position.z + handBoundsRadius));
+
+		for (const wi::scene::CameraComponent* eyeCamera : eyeCameras)
 		{
-			wi::scene::AnimationComponent* rightHandAnimation = sceneVR->animations.GetComponent(rightAnim);
-			if (rightHandAnimation != nullptr)
+			if (eyeCamera != nullptr && eyeCamera->frustum.CheckBoxFast(bounds))
 			{
-				rightHandAnimation->start = 0.0f;
-				rightHandAnimation->end = 1.0f;
-				rightHandAnimation->speed = 1.5f;
-				rightHandAnimation->SetLooped(false);
-				rightHandAnimation->Play();
-
-				if (isButtonTriggerRight())
-				{
-					if (rightHandAnimation->timer < rightHandAnimation->end)
-					{
-						rightHandAnimation->timer += dt * rightHandAnimation->speed; // avancer timer
-						if (rightHandAnimation->timer > rightHandAnimation->end) rightHandAnimation->timer = rightHandAnimation->end;
-					}
-				}
-				else
-				{
-					if (rightHandAnimation->timer > rightHandAnimation->start)
-					{
-						rightHandAnimation->timer -= dt * rightHandAnimation->speed; // reculer timer
-						if (rightHandAnimation->timer < rightHandAnimation->start) rightHandAnimation->timer = rightHandAnimation->start;
-					}
-				}
+				handVisible[hand] = true;
 			}
 		}
+
+		if (eyeCameras[0] != nullptr)
+		{
+			float distance = wi::math::Distance(position, eyeCameras[0]->Eye);
+			handNear[hand] = distance <= handLodDistance;
+		}
 	}
 }
 
@@ -599,30 +1014,391 @@ bool EngineVrManager::isVrSessionActive()
 	return isVrRunning;
 }
 
-std::string EngineVrManager::GetTrackedDeviceString(vr::IVRSystem* pHmd, vr::TrackedDeviceIndex_t unDevice, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* peError)
+void EngineVrManager::setHybridMonoEnabled(bool value)
 {
-	uint32_t unRequiredBufferLen = pHmd->GetStringTrackedDeviceProperty(unDevice, prop, nullptr, 0, peError);
-	if (unRequiredBufferLen == 0)
-		return "";
+	if (hybridMono == value)
+		return;
 
-	char* pchBuffer = new char[unRequiredBufferLen];
-	unRequiredBufferLen = pHmd->GetStringTrackedDeviceProperty(unDevice, prop, pchBuffer, unRequiredBufferLen, peError);
-	std::string sResult = pchBuffer;
-	delete[] pchBuffer;
-	return sResult;
+	hybridMono = value;
+
+	if (isVrRunning)
+	{
+		updateProjections();
+
+		//the center camera exists before the next frame, so no frame renders the eyes without a scene update
+		if (hybridMono)
+		{
+			createFarFieldCamera();
+		}
+	}
+
+	if (!hybridMono && wi::scene::GetScene().cameras.GetComponent(cameraEntityCenter) != nullptr)
+	{
+		wi::scene::GetScene().Entity_Remove(cameraEntityCenter, true);
+		cameraEntityCenter = wi::ecs::INVALID_ENTITY;
+	}
 }
 
-XMMATRIX EngineVrManager::GetHMDMatrixPoseEye(vr::Hmd_Eye nEye)
+bool EngineVrManager::isHybridMonoEnabled()
 {
-	if (!hmd)
-		return XMMATRIX();
+	return hybridMono;
+}
 
-	vr::HmdMatrix34_t matEyeRight = hmd->GetEyeToHeadTransform(nEye);
+void EngineVrManager::setFarFieldSplitDistance(float value)
+{
+	farFieldSplitDistance = std::max(value, 1.0f);
 
-	return ConvertSteamVRMatrixToXMMATRIX(matEyeRight);
+	if (isVrRunning)
+	{
+		updateProjections();
+	}
 }
 
-XMMATRIX EngineVrManager::ConvertSteamVRMatrixToXMMATRIX(const vr::HmdMatrix34_t& matPose)
+float EngineVrManager::getFarFieldSplitDistance()
+{
+	return farFieldSplitDistance;
+}
+
+const EngineVrManager::FrameStats& EngineVrManager::getFrameStats()
+{
+	return frameStats;
+}
+
+bool EngineVrManager::getControllerRay(HAND hand, wi::primitive::Ray& ray)
+{
+	if (hand >= HAND_COUNT || !controllerRayValid[hand])
+		return false;
+
+	ray = controllerRays[hand];
+	return true;
+}
+
+//Both hands are traced together the first time a layer/filter combination is asked for in a frame, later calls hit the cache
+const wi::scene::Scene::RayIntersectionResult& EngineVrManager::getControllerRayHit(HAND hand, uint32_t layerMask, uint32_t filterMask)
+{
+	static const wi::scene::Scene::RayIntersectionResult noHit;
+
+	if (hand >= HAND_COUNT || !controllerRayValid[hand] || sceneVR == nullptr)
+		return noHit;
+
+	for (uint32_t i = 0; i < rayCacheCount; ++i)
+	{
+		if (rayCache[i].layerMask == layerMask && rayCache[i].filterMask == filterMask)
+		{
+			return rayCache[i].results[hand];
+		}
+	}
+
+	//cache is full: reusing an entry would change results already handed out by reference this frame
+	if (rayCacheCount == rayCacheSize)
+		return noHit;
+
+	RayCacheEntry& entry = rayCache[rayCacheCount++];
+	entry.layerMask = layerMask;
+	entry.filterMask = filterMask;
+
+	wi::primitive::Ray rays[HAND_COUNT];
+	for (int i = 0; i < HAND_COUNT; ++i)
+	{
+		//an invalid hand gets an empty ray so it never hits
+		rays[i] = controllerRayValid[i] ? controllerRays[i] : wi::primitive::Ray(XMVectorZero(), XMVectorSet(0, 0, 1, 0), 0.0f, 0.0f);
+	}
+	//the hands and controller models sit on the ray origin, everything else (skinned or not) can be hit
+	wi::ecs::Entity ignore[] = { leftHand, rightHand, controllerModels.getSlotEntity(HAND_LEFT), controllerModels.getSlotEntity(HAND_RIGHT) };
+	EngineVrRayQuery::trace(*sceneVR, rays, HAND_COUNT, filterMask, layerMask, entry.results, ignore, (uint32_t)arraysize(ignore));
+
+	return entry.results[hand];
+}
+
+void EngineVrManager::setControllerRayLength(float value)
+{
+	controllerRayLength = std::max(value, 0.0f);
+}
+
+void EngineVrManager::setControllerModelsEnabled(bool value)
+{
+	controllerModelsEnabled = value;
+}
+
+bool EngineVrManager::isControllerModelsEnabled()
+{
+	return controllerModelsEnabled;
+}
+
+void EngineVrManager::setControllerModelCacheDirectory(const std::string& value)
+{
+	controllerModelCacheDirectory = value;
+}
+
+void EngineVrManager::setShadowCacheEnabled(bool value)
+{
+	shadowCache.setEnabled(value);
+}
+
+bool EngineVrManager::isShadowCacheEnabled()
+{
+	return shadowCache.isEnabled();
+}
+
+void EngineVrManager::setInputBackend(INPUT_BACKEND value)
+{
+	inputBackend = value;
+}
+
+EngineVrManager::INPUT_BACKEND EngineVrManager::getInputBackend()
+{
+	return inputBackend;
+}
+
+void EngineVrManager::setActionManifestPath(const std::string& value)
+{
+	actionManifestPath = value;
+}
+
+bool EngineVrManager::isActionInputActive()
+{
+	return actionInputActive;
+}
+
+EngineVrInput& EngineVrManager::getInput()
+{
+	return input;
+}
+
+EngineVrOverlayLayers& EngineVrManager::getOverlays()
+{
+	return overlays;
+}
+
+void EngineVrManager::setHandLodDistance(float value)
+{
+	handLodDistance = std::max(0.0f, value);
+}
+
+const char* EngineVrManager::getSubmitBackendName()
+{
+	return submitter != nullptr ? submitter->getName() : "None";
+}
+
+uint64_t EngineVrManager::getSubmittedFrameCount()
+{
+	return submitter != nullptr ? submitter->getSubmittedFrames() : 0;
+}
+
+uint64_t EngineVrManager::getSubmitDescriptorRebuilds()
+{
+	return submitter != nullptr ? submitter->getDescriptorRebuilds() : 0;
+}
+
+EngineVrStreaming& EngineVrManager::getStreaming()
+{
+	return streaming;
+}
+
+bool EngineVrManager::startRecording(const std::string& fileName)
+{
+	if (!isVrRunning || hmd == nullptr)
+	{
+		wi::backlog::post("VR recording needs a running VR session.", wi::backlog::LogLevel::Warning);
+		return false;
+	}
+
+	VrRecordHeader header;
+	header.width = widthTexture;
+	header.height = heightTexture;
+	header.displayFrequency = 1000.0f / frameBudgetMs;
+	memcpy(header.projectionRaw, projectionRaw, sizeof(projectionRaw));
+	header.setEyeToHead(vr::Eye_Left, hmd->GetEyeToHeadTransform(vr::Eye_Left));
+	header.setEyeToHead(vr::Eye_Right, hmd->GetEyeToHeadTransform(vr::Eye_Right));
+
+	return recorder.start(fileName, header);
+}
+
+void EngineVrManager::stopRecording()
+{
+	recorder.stop();
+}
+
+bool EngineVrManager::isRecording()
+{
+	return recorder.isRecording();
+}
+
+bool EngineVrManager::startReplay(const std::string& fileName)
+{
+	if (isVrRunning)
+	{
+		wi::backlog::post("VR replay must be started before the VR session.", wi::backlog::LogLevel::Warning);
+		return false;
+	}
+
+	replayFrameIndex = 0;
+	return replay.open(fileName);
+}
+
+void EngineVrManager::stopReplay()
+{
+	if (isVrRunning && replay.isOpen())
+	{
+		stopVrSession();
+	}
+	replay.close();
+}
+
+bool EngineVrManager::isReplaying()
+{
+	return replay.isOpen();
+}
+
+bool EngineVrManager::isReplayFinished()
+{
+	return replay.isOpen() && replayFrameIndex >= replay.getFrameCount();
+}
+
+void EngineVrManager::setSpectatorEnabled(bool value)
+{
+	spectatorEnabled = value;
+	spectatorFrameCounter = 0;
+	spectatorDeferredFrames = 0;
+	spectatorPhase = SPECTATOR_WAIT;
+
+	if (!spectatorEnabled)
+	{
+		spectatorTexture = nullptr;
+		if (wi::scene::GetScene().cameras.GetComponent(cameraEntitySpectator) != nullptr)
+		{
+			wi::scene::GetScene().Entity_Remove(cameraEntitySpectator, true);
+			cameraEntitySpectator = wi::ecs::INVALID_ENTITY;
+		}
+	}
+}
+
+bool EngineVrManager::isSpectatorEnabled()
+{
+	return spectatorEnabled;
+}
+
+void EngineVrManager::setSpectatorFrameInterval(uint32_t value)
+{
+	//culling and rendering need one frame each
+	spectatorFrameInterval = std::max(value, 2u);
+}
+
+void EngineVrManager::setSpectatorResolution(uint32_t width, uint32_t height)
+{
+	spectatorWidth = std::max(width, 1u);
+	spectatorHeight = std::max(height, 1u);
+}
+
+void EngineVrManager::setSpectatorTransform(const XMMATRIX& world)
+{
+	XMStoreFloat4x4(&spectatorWorld, world);
+}
+
+const wi::graphics::Texture* EngineVrManager::getSpectatorTexture()
+{
+	return spectatorTexture;
+}
+
+void EngineVrManager::setMirrorMode(MIRROR_MODE value)
+{
+	mirrorMode = value;
+}
+
+EngineVrManager::MIRROR_MODE EngineVrManager::getMirrorMode()
+{
+	return mirrorMode;
+}
+
+bool EngineVrManager::isDesktopRenderSkipped()
+{
+	return isVrRunning && mirrorMode != MIRROR_DISABLED;
+}
+
+void EngineVrManager::composeMirror(wi::graphics::CommandList cmd, const wi::Canvas& canvas)
+{
+	if (!isDesktopRenderSkipped())
+		return;
+
+	float width = canvas.GetLogicalWidth();
+	float height = canvas.GetLogicalHeight();
+
+	if (mirrorMode == MIRROR_LEFT_EYE)
+	{
+		drawMirrorEye(rtLeftTexture, mat4ProjectionLeft, 0.0f, 0.0f, width, height, cmd);
+	}
+	else
+	{
+		drawMirrorEye(rtLeftTexture, mat4ProjectionLeft, 0.0f, 0.0f, width * 0.5f, height, cmd);
+		drawMirrorEye(rtRightTexture, mat4ProjectionRight, width * 0.5f, 0.0f, width * 0.5f, height, cmd);
+	}
+}
+
+//Eye images are submitted before lens distortion, so the mirror only has to crop the periphery around the optical center
+void EngineVrManager::drawMirrorEye(const wi::graphics::Texture& image, const XMMATRIX& projectionMatrix, float x, float y, float width, float height, wi::graphics::CommandList cmd)
+{
+	if (!image.IsValid() || width <= 0.0f || height <= 0.0f)
+		return;
+
+	float imageWidth = (float)image.desc.width;
+	float imageHeight = (float)image.desc.height;
+
+	//optical center of the asymmetric eye projection, in pixels
+	XMFLOAT4X4 proj;
+	XMStoreFloat4x4(&proj, projectionMatrix);
+	float centerX = (0.5f + 0.5f * proj._31) * imageWidth;
+	float centerY = (0.5f - 0.5f * proj._32) * imageHeight;
+
+	//largest rect with the destination aspect ratio that fits inside the cropped image
+	float aspect = width / height;
+	float rectHeight = imageHeight * (1.0f - mirrorCrop);
+	float rectWidth = rectHeight * aspect;
+	if (rectWidth > imageWidth * (1.0f - mirrorCrop))
+	{
+		rectWidth = imageWidth * (1.0f - mirrorCrop);
+		rectHeight = rectWidth / aspect;
+	}
+
+	float rectX = std::clamp(centerX - rectWidth * 0.5f, 0.0f, imageWidth - rectWidth);
+	float rectY = std::clamp(centerY - rectHeight * 0.5f, 0.0f, imageHeight - rectHeight);
+
+	wi::image::Params fx;
+	fx.pos = XMFLOAT3(x, y, 0.0f);
+	fx.siz = XMFLOAT2(width, height);
+	fx.quality = wi::image::QUALITY_LINEAR;
+	fx.sampleFlag = wi::image::SAMPLEMODE_CLAMP;
+	fx.enableDrawRect(XMFLOAT4(rectX, rectY, rectWidth, rectHeight));
+	wi::image::Draw(&image, fx, cmd);
+}
+
+std::string_view EngineVrManager::GetTrackedDeviceString(vr::IVRSystem* pHmd, vr::TrackedDeviceIndex_t unDevice, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* peError)
+{
+	uint32_t unRequiredBufferLen = pHmd->GetStringTrackedDeviceProperty(unDevice, prop, nullptr, 0, peError);
+	if (unRequiredBufferLen == 0)
+		return std::string_view();
+
+	char* pchBuffer = frameArena.allocate<char>(unRequiredBufferLen);
+	if (pchBuffer == nullptr)
+		return std::string_view();
+
+	unRequiredBufferLen = pHmd->GetStringTrackedDeviceProperty(unDevice, prop, pchBuffer, unRequiredBufferLen, peError);
+	if (unRequiredBufferLen == 0)
+		return std::string_view();
+
+	return std::string_view(pchBuffer, unRequiredBufferLen - 1);
+}
+
+XMMATRIX EngineVrManager::GetHMDMatrixPoseEye(vr::Hmd_Eye nEye)
+{
+	if (!hmd)
+		return XMMATRIX();
+
+	vr::HmdMatrix34_t matEyeRight = hmd->GetEyeToHeadTransform(nEye);
+
+	return ConvertSteamVRMatrixToXMMATRIX(matEyeRight);
+}
+
+XMMATRIX EngineVrManager::ConvertSteamVRMatrixToXMMATRIX(const vr::HmdMatrix34_t& matPose)
 {
 	XMMATRIX matrixObj(
 		matPose.m[0][0], matPose.m[1][0], -matPose.m[2][0], 0.0,
@@ -634,16 +1410,92 @@ XMMATRIX EngineVrManager::ConvertSteamVRMatrixToXMMATRIX(const vr::HmdMatrix34_t
 	return matrixObj;
 }
 
-XMMATRIX EngineVrManager::GetHMDMatrixProjectionEye(vr::Hmd_Eye nEye)
+XMMATRIX EngineVrManager::GetHMDMatrixProjectionEye(vr::Hmd_Eye nEye, float zNear, float zFar)
 {
-	if (!hmd)
-		return XMMATRIX();
+	//near and far are swapped for reversed depth
+	vr::HmdMatrix44_t mat = ComposeProjection(projectionRaw[nEye][0], projectionRaw[nEye][1], projectionRaw[nEye][2], projectionRaw[nEye][3], zFar, zNear);
+
+	return ConvertSteamVRProjectionToXMMATRIX(mat);
+}
+
+//Part of the center image each eye sees: its tangents mapped into the union of both eyes, as (x, y, width, height) fractions
+void EngineVrManager::updateFarFieldCrop()
+{
+	float left = std::min(projectionRaw[vr::Eye_Left][0], projectionRaw[vr::Eye_Right][0]);
+	float right = std::max(projectionRaw[vr::Eye_Left][1], projectionRaw[vr::Eye_Right][1]);
+	float top = std::min(projectionRaw[vr::Eye_Left][2], projectionRaw[vr::Eye_Right][2]);
+	float bottom = std::max(projectionRaw[vr::Eye_Left][3], projectionRaw[vr::Eye_Right][3]);
 
-	float zNear = 1000.0f;
-	float zFar = 0.1f;
+	if (right <= left || bottom <= top)
+		return;
 
-	vr::HmdMatrix44_t mat = hmd->GetProjectionMatrix(nEye, zNear, zFar);
+	for (int nEye = vr::Eye_Left; nEye <= vr::Eye_Right; ++nEye)
+	{
+		farFieldCrop[nEye].x = (projectionRaw[nEye][0] - left) / (right - left);
+		farFieldCrop[nEye].y = (projectionRaw[nEye][2] - top) / (bottom - top);
+		farFieldCrop[nEye].z = (projectionRaw[nEye][1] - projectionRaw[nEye][0]) / (right - left);
+		farFieldCrop[nEye].w = (projectionRaw[nEye][3] - projectionRaw[nEye][2]) / (bottom - top);
+	}
+}
 
+//The eye paths draw a plain background instead of the sky while the far field provides it (the composite covers it)
+void EngineVrManager::setEyeSkyEnabled(bool value)
+{
+	wi::scene::WeatherComponent& weather = wi::scene::GetScene().weather;
+
+	if (!value)
+	{
+		eyeSkySaved.realisticSky = weather.IsRealisticSky();
+		eyeSkySaved.volumetricClouds = weather.IsVolumetricClouds();
+		eyeSkySaved.skyMap = weather.skyMap;
+		weather.SetRealisticSky(false);
+		weather.SetVolumetricClouds(false);
+		weather.skyMap = {};
+	}
+	else
+	{
+		weather.SetRealisticSky(eyeSkySaved.realisticSky);
+		weather.SetVolumetricClouds(eyeSkySaved.volumetricClouds);
+		weather.skyMap = eyeSkySaved.skyMap;
+		eyeSkySaved.skyMap = {};
+	}
+}
+
+XMMATRIX EngineVrManager::GetHMDMatrixProjectionCenter(float zNear, float zFar)
+{
+	//union of both eye frustums, so the far field covers everything either eye can see
+	float left = std::min(projectionRaw[vr::Eye_Left][0], projectionRaw[vr::Eye_Right][0]);
+	float right = std::max(projectionRaw[vr::Eye_Left][1], projectionRaw[vr::Eye_Right][1]);
+	float top = std::min(projectionRaw[vr::Eye_Left][2], projectionRaw[vr::Eye_Right][2]);
+	float bottom = std::max(projectionRaw[vr::Eye_Left][3], projectionRaw[vr::Eye_Right][3]);
+
+	//near and far are swapped for reversed depth
+	vr::HmdMatrix44_t mat = ComposeProjection(left, right, top, bottom, zFar, zNear);
+
+	return ConvertSteamVRProjectionToXMMATRIX(mat);
+}
+
+//Same composition as IVRSystem::GetProjectionMatrix, so projections can be built without the runtime (replay)
+vr::HmdMatrix44_t EngineVrManager::ComposeProjection(float left, float right, float top, float bottom, float zNear, float zFar)
+{
+	float idx = 1.0f / (right - left);
+	float idy = 1.0f / (bottom - top);
+	float idz = 1.0f / (zFar - zNear);
+
+	vr::HmdMatrix44_t mat = {};
+	mat.m[0][0] = 2.0f * idx;
+	mat.m[0][2] = (right + left) * idx;
+	mat.m[1][1] = 2.0f * idy;
+	mat.m[1][2] = (bottom + top) * idy;
+	mat.m[2][2] = -zFar * idz;
+	mat.m[2][3] = -zFar * zNear * idz;
+	mat.m[3][2] = -1.0f;
+
+	return mat;
+}
+
+XMMATRIX EngineVrManager::ConvertSteamVRProjectionToXMMATRIX(const vr::HmdMatrix44_t& mat)
+{
 	XMMATRIX returnMatrix(
 		mat.m[0][0], mat.m[1][0], mat.m[2][0], mat.m[3][0],
 		mat.m[0][1], mat.m[1][1], mat.m[2][1], mat.m[3][1],
@@ -658,102 +1510,94 @@ void EngineVrManager::render(float dt)
 {
 	if (isVrSessionActive())
 	{
-		wi::scene::CameraComponent* cameraVR = wi::scene::GetScene().cameras.GetComponent(cameraEntityLeft);
+		wi::Timer frameTimer;
+		EngineVrAllocations::beginThread();
+		frameArena.reset();
 
-		XMFLOAT4X4 mpj;
-		XMMATRIX finalMatrix = XMMatrixIdentity();
+		shadowCache.beginFrame();
+		if (!isDesktopRenderSkipped())
+		{
+			//the desktop render path draws its own shadows into the same atlas between two VR frames
+			shadowCache.invalidate();
+		}
 
-		if (cameraVR != nullptr)
+		//replay is frame exact, the recorded frame time drives the whole frame
+		if (replay.isOpen())
 		{
-			cameraVR->SetCustomProjectionEnabled(true);
+			replay.getFrameDt(replayFrameIndex, dt);
+		}
 
-			XMStoreFloat4x4(&mpj, mat4ProjectionLeft);
-			cameraVR->Projection = mpj;
-			finalMatrix = mat4eyePosLeft * mat4HMDPose * XMLoadFloat4x4(&cameraTransform.world);
-			cameraVR->TransformCamera(finalMatrix);
-			cameraVR->UpdateCamera();
-			cameraVR->SetDirty();
-			RenderRt(vr::Hmd_Eye::Eye_Left, dt);
+		//the eyes only skip the scene update and the sky when the far field really ran this frame
+		farFieldRendered = false;
+		if (hybridMono)
+		{
+			//far field first, it runs the scene update for the eyes
+			if (updateVrCamera(cameraEntityCenter, mat4ProjectionCenter, mat4eyePosCenter))
+			{
+				RenderFarField(dt);
+				farFieldRendered = true;
+			}
 		}
 
-		cameraVR = wi::scene::GetScene().cameras.GetComponent(cameraEntityRight);
+		if (farFieldRendered)
+		{
+			setEyeSkyEnabled(false);
+		}
 
-		if (cameraVR != nullptr)
+		if (updateVrCamera(cameraEntityLeft, mat4ProjectionLeft, mat4eyePosLeft))
 		{
-			cameraVR->SetCustomProjectionEnabled(true);
+			RenderRt(vr::Hmd_Eye::Eye_Left, dt);
+		}
 
-			XMStoreFloat4x4(&mpj, mat4ProjectionRight);
-			cameraVR->Projection = mpj;
-			finalMatrix = mat4eyePosRight * mat4HMDPose * XMLoadFloat4x4(&cameraTransform.world);
-			cameraVR->TransformCamera(finalMatrix);
-			cameraVR->UpdateCamera();
-			cameraVR->SetDirty();
+		if (updateVrCamera(cameraEntityRight, mat4ProjectionRight, mat4eyePosRight))
+		{
 			RenderRt(vr::Hmd_Eye::Eye_Right, dt);
 		}
 
-		vr::VRTextureBounds_t bounds;
-		bounds.uMin = 0.0f;
-		bounds.uMax = 1.0f;
-		bounds.vMin = 0.0f;
-		bounds.vMax = 1.0f;
-
-		if (dx12)
+		if (farFieldRendered)
 		{
-			wi::graphics::GraphicsDevice_DX12* deviceDx12 = (wi::graphics::GraphicsDevice_DX12*)wi::graphics::GetDevice();
-			if (deviceDx12 != nullptr)
-			{
-				if (rtLeftTexture.IsValid())
-				{
-					vr::D3D12TextureData_t d3d12LeftEyeTexture = { deviceDx12->GetTextureInternalResource(&rtLeftTexture), deviceDx12->GetGraphicsCommandQueue() , 0 };
-					vr::Texture_t leftEyeTexture = { (void*)&d3d12LeftEyeTexture, vr::TextureType_DirectX12, vr::ColorSpace_Gamma };
-					vr::VRCompositor()->Submit(vr::Eye_Left, &leftEyeTexture, &bounds, vr::Submit_Default);
-				}
-
-				if (rtRightTexture.IsValid())
-				{
-					vr::D3D12TextureData_t d3d12RightEyeTexture = { deviceDx12->GetTextureInternalResource(&rtRightTexture),deviceDx12->GetGraphicsCommandQueue() , 0 };
-					vr::Texture_t rightEyeTexture = { (void*)&d3d12RightEyeTexture, vr::TextureType_DirectX12, vr::ColorSpace_Gamma };
-					vr::VRCompositor()->Submit(vr::Eye_Right, &rightEyeTexture, &bounds, vr::Submit_Default);
-				}
-				vr::VRCompositor()->PostPresentHandoff();
-			}
+			setEyeSkyEnabled(true);
 		}
-		else
+
+		frameStats.nearDraws = (uint32_t)(renderPathLeft.visibility_main.visibleObjects.size() + renderPathRight.visibility_main.visibleObjects.size());
+		frameStats.farDraws = farFieldRendered ? (uint32_t)renderPathCenter.visibility_main.visibleObjects.size() : 0;
+		frameStats.totalDraws = frameStats.nearDraws + frameStats.farDraws;
+
+		if (submitter != nullptr)
 		{
-			wi::graphics::GraphicsDevice_Vulkan* deviceVulkan = (wi::graphics::GraphicsDevice_Vulkan*)wi::graphics::GetDevice();
-			if (deviceVulkan != nullptr)
-			{
-				vr::VRVulkanTextureData_t vulkanData;
-				vulkanData.m_pDevice = deviceVulkan->GetDevice();
-				vulkanData.m_pPhysicalDevice = deviceVulkan->GetPhysicalDevice();
-				vulkanData.m_pInstance = deviceVulkan->GetInstance();
-				vulkanData.m_pQueue = deviceVulkan->GetGraphicsCommandQueue();
-				vulkanData.m_nQueueFamilyIndex = deviceVulkan->GetGraphicsFamilyIndex();
-				vulkanData.m_nWidth = rtLeftTexture.desc.width;
-				vulkanData.m_nHeight = rtLeftTexture.desc.height;
-				vulkanData.m_nFormat = VK_FORMAT_R8G8B8A8_UNORM;
-				vulkanData.m_nSampleCount = 0;
-
-				if (rtLeftTexture.IsValid())
-				{
-					VkImage imageLeft = deviceVulkan->GetTextureInternalResource(&rtLeftTexture);
-					vulkanData.m_nImage = (uint64_t)imageLeft;
-					vr::Texture_t leftEyeTexture = { &vulkanData, vr::TextureType_Vulkan, vr::ColorSpace_Gamma };
-					vr::VRCompositor()->Submit(vr::Eye_Left, &leftEyeTexture, &bounds);
-				}
+			submitter->submit(rtLeftTexture, rtRightTexture);
+		}
 
-				if (rtRightTexture.IsValid())
-				{
-					VkImage imageRight = deviceVulkan->GetTextureInternalResource(&rtRightTexture);
-					vulkanData.m_nImage = (uint64_t)(imageRight);
-					vr::Texture_t rightEyeTexture = { &vulkanData, vr::TextureType_Vulkan, vr::ColorSpace_Gamma };
-					vr::VRCompositor()->Submit(vr::Eye_Right, &rightEyeTexture, &bounds);
-				}
-				vr::VRCompositor()->PostPresentHandoff();
-			}
+		frameStats.eyesCpuMs = (float)frameTimer.elapsed_milliseconds();
+
+		//layers are redrawn after the eye submit, at their own rate
+		overlays.update(dt, XMLoadFloat4x4(&cameraTransform.world), submitter.get());
+		frameStats.overlayRedraws = overlays.getStats().redraws;
+		frameStats.frameBudgetMs = frameBudgetMs;
+
+		vr::Compositor_FrameTiming frameTiming;
+		frameTiming.m_nSize = sizeof(vr::Compositor_FrameTiming);
+		if (hmd != nullptr && vr::VRCompositor()->GetFrameTiming(&frameTiming, 0))
+		{
+			frameStats.compositorGpuMs = frameTiming.m_flTotalRenderGpuMs;
 		}
 
+		//after the eyes are handed off, so the spectator never delays the submit
+		updateSpectator(dt);
+
+		frameStats.cachedShadowMaps = shadowCache.getStats().cachedMaps;
+		frameStats.renderedShadowMaps = shadowCache.getStats().renderedMaps;
+		frameStats.shadowDirectionalMisses = shadowCache.getStats().directionalMisses;
+		frameStats.shadowAtlasMisses = shadowCache.getStats().atlasMisses;
+		frameStats.shadowDirtyLightMisses = shadowCache.getStats().dirtyLightMisses;
+
 		EngineVrManager::getInstance()->updateVrSession(dt);
+
+		frameStats.heapAllocations = (uint32_t)EngineVrAllocations::getCount();
+		frameStats.wickedHeapAllocations = (uint32_t)EngineVrAllocations::getExcludedCount();
+		EngineVrAllocations::endThread();
+		frameStats.arenaBytes = (uint32_t)frameArena.getUsed();
+		frameStats.arenaOverflows = frameArena.getOverflows();
 	}
 }
 
@@ -763,73 +1607,272 @@ void EngineVrManager::RenderRt(vr::Hmd_Eye nEye, float dt)
 	if (nEye == vr::Hmd_Eye::Eye_Left)
 	{
 		renderPathLeft.camera = wi::scene::GetScene().cameras.GetComponent(cameraEntityLeft);
-		renderPathLeft.setSceneUpdateEnabled(true);
+		renderPathLeft.setSceneUpdateEnabled(!farFieldRendered);
 		renderPathLeft.setOcclusionCullingEnabled(false);
-		renderPathLeft.PreUpdate();
-		renderPathLeft.Update(dt);
-		renderPathLeft.PostUpdate();
-		renderPathLeft.PreRender();
-		renderPathLeft.Render();
-		rtLeftTexture = resizeImage(*renderPathLeft.lastPostprocessRT, widthTexture, heightTexture);
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathLeft.PreUpdate();
+			renderPathLeft.Update(dt);
+			renderPathLeft.PostUpdate();
+		}
+		shadowCache.prepare(renderPathLeft);
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathLeft.PreRender();
+			renderPathLeft.Render();
+		}
+
+		if (farFieldRendered && renderPathCenter.lastPostprocessRT != nullptr)
+		{
+			wi::graphics::Texture composite = compositeFarField(*renderPathLeft.lastPostprocessRT, *renderPathLeft.GetDepthStencil(), *renderPathCenter.lastPostprocessRT, farFieldCrop[vr::Eye_Left], compositeTargets[vr::Eye_Left]);
+			rtLeftTexture = resizeImage(composite, widthTexture, heightTexture, resizeTargets[vr::Eye_Left]);
+		}
+		else
+		{
+			rtLeftTexture = resizeImage(*renderPathLeft.lastPostprocessRT, widthTexture, heightTexture, resizeTargets[vr::Eye_Left]);
+		}
 	}
 	else
 	{
 		renderPathRight.camera = wi::scene::GetScene().cameras.GetComponent(cameraEntityRight);
 		renderPathRight.setSceneUpdateEnabled(false);
 		renderPathRight.setOcclusionCullingEnabled(false);
-		renderPathRight.PreUpdate();
-		renderPathRight.Update(dt);
-		renderPathRight.PostUpdate();
-		renderPathRight.PreRender();
-		renderPathRight.Render();
-		rtRightTexture = resizeImage(*renderPathRight.lastPostprocessRT, widthTexture, heightTexture);
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathRight.PreUpdate();
+			renderPathRight.Update(dt);
+			renderPathRight.PostUpdate();
+		}
+		shadowCache.prepare(renderPathRight);
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathRight.PreRender();
+			renderPathRight.Render();
+		}
+
+		if (farFieldRendered && renderPathCenter.lastPostprocessRT != nullptr)
+		{
+			wi::graphics::Texture composite = compositeFarField(*renderPathRight.lastPostprocessRT, *renderPathRight.GetDepthStencil(), *renderPathCenter.lastPostprocessRT, farFieldCrop[vr::Eye_Right], compositeTargets[vr::Eye_Right]);
+			rtRightTexture = resizeImage(composite, widthTexture, heightTexture, resizeTargets[vr::Eye_Right]);
+		}
+		else
+		{
+			rtRightTexture = resizeImage(*renderPathRight.lastPostprocessRT, widthTexture, heightTexture, resizeTargets[vr::Eye_Right]);
+		}
 	}
 }
 
-wi::graphics::Texture EngineVrManager::resizeImage(const wi::graphics::Texture& image, int width, int height)
+//One spectator phase at most per frame, and only when the eyes left enough of the frame budget
+void EngineVrManager::updateSpectator(float dt)
 {
-	wi::graphics::Texture renderTargetResize = {};
+	frameStats.spectatorCpuMs = 0.0f;
+	frameStats.spectatorPhase = (uint32_t)spectatorPhase;
+
+	if (!spectatorEnabled)
+		return;
+
+	createSpectatorCamera();
+
+	spectatorDt += dt;
+	spectatorFrameCounter++;
 
-	if (image.IsValid())
+	if (spectatorPhase == SPECTATOR_WAIT)
 	{
-		wi::graphics::GraphicsDevice* device = wi::graphics::GetDevice();
-		wi::graphics::RenderPass resizeTexture;
+		if (spectatorFrameCounter < spectatorFrameInterval)
+			return;
+
+		spectatorPhase = SPECTATOR_CULL;
+	}
+
+	//defer while it would push the frame over budget, a phase is never forced:
+	//after one interval of deferral the cycle is dropped and the previous image is kept
+	if (frameStats.eyesCpuMs + spectatorPhaseMs[spectatorPhase] > frameBudgetMs)
+	{
+		spectatorDeferredFrames++;
+		if (spectatorDeferredFrames > spectatorFrameInterval)
+		{
+			spectatorDeferredFrames = 0;
+			spectatorFrameCounter = 0;
+			spectatorPhase = SPECTATOR_WAIT;
+			frameStats.spectatorSkippedCycles++;
+		}
+		return;
+	}
+	spectatorDeferredFrames = 0;
+
+	wi::Timer timer;
+	frameStats.spectatorPhase = (uint32_t)spectatorPhase;
+
+	wi::scene::CameraComponent* cameraSpectator = wi::scene::GetScene().cameras.GetComponent(cameraEntitySpectator);
+
+	if (spectatorPhase == SPECTATOR_CULL)
+	{
+		//scene update is already done by the eyes this frame, only the spectator frustum is culled here
+		cameraSpectator->CreatePerspective((float)spectatorWidth, (float)spectatorHeight, 0.1f, 1000.0f);
+		cameraSpectator->TransformCamera(XMLoadFloat4x4(&spectatorWorld));
+		cameraSpectator->UpdateCamera();
+		cameraSpectator->SetDirty();
+
+		renderPathSpectator.setSceneUpdateEnabled(false);
+		renderPathSpectator.setOcclusionCullingEnabled(false);
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathSpectator.PreUpdate();
+			renderPathSpectator.Update(spectatorDt);
+			renderPathSpectator.PostUpdate();
+		}
+		spectatorObjectCount = (uint32_t)wi::scene::GetScene().objects.GetCount();
+		spectatorDt = 0.0f;
+		spectatorPhase = SPECTATOR_RENDER;
+	}
+	else
+	{
+		//visibility indices from the previous frame are stale if objects were added or removed since
+		if (spectatorObjectCount != (uint32_t)wi::scene::GetScene().objects.GetCount())
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathSpectator.Update(0.0f);
+		}
+
+		shadowCache.prepare(renderPathSpectator);
+		{
+			EngineVrAllocations::Excluded excluded;
+			renderPathSpectator.PreRender();
+			renderPathSpectator.Render();
+		}
+		spectatorTexture = renderPathSpectator.lastPostprocessRT;
+		spectatorFrameCounter = 0;
+		spectatorPhase = SPECTATOR_WAIT;
+	}
+
+	frameStats.spectatorCpuMs = (float)timer.elapsed_milliseconds();
+	spectatorPhaseMs[frameStats.spectatorPhase] = frameStats.spectatorCpuMs;
+}
+
+void EngineVrManager::RenderFarField(float dt)
+{
+	renderPathCenter.camera = wi::scene::GetScene().cameras.GetComponent(cameraEntityCenter);
+	renderPathCenter.setSceneUpdateEnabled(true);
+	renderPathCenter.setOcclusionCullingEnabled(false);
+	{
+		EngineVrAllocations::Excluded excluded;
+		renderPathCenter.PreUpdate();
+		renderPathCenter.Update(dt);
+		renderPathCenter.PostUpdate();
+	}
+	shadowCache.prepare(renderPathCenter);
+
+	EngineVrAllocations::Excluded excluded;
+	renderPathCenter.PreRender();
+	renderPathCenter.Render();
+}
+
+//Draw the eye image, then the far field image only where the eye depth buffer is still cleared (no near geometry)
+//Composite and resize targets are kept between frames, they are only created again when the size or the attached depth changes
+wi::graphics::Texture EngineVrManager::compositeFarField(const wi::graphics::Texture& nearImage, const wi::graphics::Texture& nearDepth, const wi::graphics::Texture& farImage, const XMFLOAT4& farCrop, RenderTarget& target)
+{
+	if (!nearImage.IsValid() || !nearDepth.IsValid() || !farImage.IsValid())
+		return wi::graphics::Texture();
+
+	wi::graphics::GraphicsDevice* device = wi::graphics::GetDevice();
+
+	if (!target.texture.IsValid() || target.texture.desc.width != nearImage.desc.width || target.texture.desc.height != nearImage.desc.height ||
+		target.texture.desc.format != nearImage.desc.format || target.depth.internal_state != nearDepth.internal_state)
+	{
+		target = RenderTarget();
+
+		wi::graphics::TextureDesc desc;
+		desc.width = nearImage.desc.width;
+		desc.height = nearImage.desc.height;
+		desc.format = nearImage.desc.format;
+		desc.bind_flags = wi::graphics::BindFlag::RENDER_TARGET | wi::graphics::BindFlag::SHADER_RESOURCE;
+		if (!device->CreateTexture(&desc, nullptr, &target.texture))
+			return wi::graphics::Texture();
+
+		wi::graphics::RenderPassDesc passDesc;
+		passDesc.attachments.push_back(wi::graphics::RenderPassAttachment::RenderTarget(target.texture, wi::graphics::RenderPassAttachment::LoadOp::DONTCARE));
+		passDesc.attachments.push_back(wi::graphics::RenderPassAttachment::DepthStencil(nearDepth, wi::graphics::RenderPassAttachment::LoadOp::LOAD));
+		device->CreateRenderPass(&passDesc, &target.renderPass);
+		target.depth = nearDepth;
+	}
+
+	EngineVrAllocations::Excluded excluded;
+	wi::graphics::CommandList cmd = device->BeginCommandList();
+
+	device->EventBegin("CompositeFarField", cmd);
+
+	wi::graphics::Viewport vp;
+	vp.width = (float)target.texture.desc.width;
+	vp.height = (float)target.texture.desc.height;
+
+	device->BindViewports(1, &vp, cmd);
+	device->RenderPassBegin(&target.renderPass, cmd);
+
+	wi::image::Params fx;
+	fx.enableFullScreen();
+	wi::image::Draw(&nearImage, fx, cmd);
+
+	//the far image covers both eyes, only the part this eye sees is stretched over the target.
+	//it sits on the far plane (reversed depth 0), so it only passes where nothing near was drawn
+	float farWidth = (float)farImage.desc.width;
+	float farHeight = (float)farImage.desc.height;
+	fx.enableDrawRect(XMFLOAT4(farCrop.x * farWidth, farCrop.y * farHeight, farCrop.z * farWidth, farCrop.w * farHeight));
+	fx.enableDepthTest();
+	wi::image::Draw(&farImage, fx, cmd);
+
+	device->RenderPassEnd(cmd);
+
+	device->EventEnd(cmd);
+
+	device->SubmitCommandLists();
+
+	return target.texture;
+}
+
+wi::graphics::Texture EngineVrManager::resizeImage(const wi::graphics::Texture& image, int width, int height, RenderTarget& target)
+{
+	if (!image.IsValid())
+		return wi::graphics::Texture();
+
+	wi::graphics::GraphicsDevice* device = wi::graphics::GetDevice();
+
+	if (!target.texture.IsValid() || target.texture.desc.width != (uint32_t)width || target.texture.desc.height != (uint32_t)height)
+	{
+		target = RenderTarget();
 
 		wi::graphics::TextureDesc desc;
 		desc.width = width;
 		desc.height = height;
 		desc.format = wi::graphics::Format::R8G8B8A8_UNORM;
-		desc.bind_flags = wi::graphics::BindFlag::RENDER_TARGET;// | BindFlag::SHADER_RESOURCE;
-		if (device->CreateTexture(&desc, nullptr, &renderTargetResize))
-		{
-			wi::graphics::RenderPassDesc desc;
-			desc.attachments.push_back(wi::graphics::RenderPassAttachment::RenderTarget(renderTargetResize, wi::graphics::RenderPassAttachment::LoadOp::CLEAR));
-			if (device->CreateRenderPass(&desc, &resizeTexture))
-			{
-				desc.attachments[0].texture = renderTargetResize;
-			}
-		}
+		desc.bind_flags = wi::graphics::BindFlag::RENDER_TARGET | wi::graphics::BindFlag::SHADER_RESOURCE;//shader resource for the desktop mirror
+		if (!device->CreateTexture(&desc, nullptr, &target.texture))
+			return wi::graphics::Texture();
 
-		wi::graphics::CommandList cmd = device->BeginCommandList();
+		wi::graphics::RenderPassDesc passDesc;
+		passDesc.attachments.push_back(wi::graphics::RenderPassAttachment::RenderTarget(target.texture, wi::graphics::RenderPassAttachment::LoadOp::CLEAR));
+		device->CreateRenderPass(&passDesc, &target.renderPass);
+	}
 
-		device->EventBegin("ResizeTexture", cmd);
+	EngineVrAllocations::Excluded excluded;
+	wi::graphics::CommandList cmd = device->BeginCommandList();
 
-		wi::graphics::Viewport vp;
-		vp.width = (float)width;
-		vp.height = (float)height;
+	device->EventBegin("ResizeTexture", cmd);
 
-		wi::image::Params fx;
-		fx.enableFullScreen();
+	wi::graphics::Viewport vp;
+	vp.width = (float)width;
+	vp.height = (float)height;
 
-		device->BindViewports(1, &vp, cmd);
-		device->RenderPassBegin(&resizeTexture, cmd);
-		wi::image::Draw(&image, fx, cmd);
-		device->RenderPassEnd(cmd);
+	wi::image::Params fx;
+	fx.enableFullScreen();
 
-		device->EventEnd(cmd);
+	device->BindViewports(1, &vp, cmd);
+	device->RenderPassBegin(&target.renderPass, cmd);
+	wi::image::Draw(&image, fx, cmd);
+	device->RenderPassEnd(cmd);
 
-		device->SubmitCommandLists();
-	}
+	device->EventEnd(cmd);
+
+	device->SubmitCommandLists();
 
-	return renderTargetResize;
+	return target.texture;
 }
@@ -1,14 +1,16 @@
 #pragma once
 #include <WickedEngine.h>
-#include "wiGraphicsDevice_DX12.h"
-#include "wiGraphicsDevice_Vulkan.h"
-
-#include <d3d12.h>
-//#include <vulkan/vulkan.h>
-
-#include <wrl/client.h>
 
 #include "openvr.h"
+#include "EngineVrBackend.h"
+#include "EngineVrRecording.h"
+#include "EngineVrStreaming.h"
+#include "EngineVrRayQuery.h"
+#include "EngineVrRenderModels.h"
+#include "EngineVrShadowCache.h"
+#include "EngineVrMemory.h"
+#include "EngineVrInput.h"
+#include "EngineVrOverlay.h"
 
 class EngineVrManager
 {
@@ -57,6 +59,126 @@ public:
 	bool isButtonGripLeft();
 	bool isButtonGripRight();
 
+	//Hybrid mono: geometry beyond the split distance is rendered once from a center eye
+	void setHybridMonoEnabled(bool value);
+	bool isHybridMonoEnabled();
+	void setFarFieldSplitDistance(float value);
+	float getFarFieldSplitDistance();
+
+	struct FrameStats
+	{
+		uint32_t nearDraws = 0;
+		uint32_t farDraws = 0;
+		uint32_t totalDraws = 0;
+
+		//CPU time of both eyes (render and submit), and of the spectator phase run this frame
+		float eyesCpuMs = 0.0f;
+		float spectatorCpuMs = 0.0f;
+		uint32_t spectatorPhase = 0;
+		//spectator cycles dropped because a phase did not fit the budget within one interval, total
+		uint32_t spectatorSkippedCycles = 0;
+		float frameBudgetMs = 0.0f;
+		//GPU time reported by the compositor for the last frame
+		float compositorGpuMs = 0.0f;
+		//shadow maps reused from the atlas and drawn again, summed over the render paths of the frame
+		uint32_t cachedShadowMaps = 0;
+		uint32_t renderedShadowMaps = 0;
+		//render paths that drew their shadow pass again, by reason (see EngineVrShadowCache::Stats)
+		uint32_t shadowDirectionalMisses = 0;
+		uint32_t shadowAtlasMisses = 0;
+		uint32_t shadowDirtyLightMisses = 0;
+		//global heap allocations on the frame thread during the VR frame (only counted with ENGINEVR_COUNT_ALLOCATIONS),
+		//made by this code and by the Wicked render paths and draws it calls, and frame arena use
+		uint32_t heapAllocations = 0;
+		uint32_t wickedHeapAllocations = 0;
+		uint32_t arenaBytes = 0;
+		uint32_t arenaOverflows = 0;
+		//overlay layer textures redrawn this frame
+		uint32_t overlayRedraws = 0;
+		//hand animation timers applied this frame, and left as they were (timer unchanged, hand out of view or LOD frame).
+		//Only the animation sampling is skipped, Wicked still updates the hand armatures and skins the hands every frame
+		uint32_t handAnimationSamples = 0;
+		uint32_t handAnimationSampleSkips = 0;
+	};
+	const FrameStats& getFrameStats();
+
+	//Desktop mirror: presents the submitted eye textures instead of a third scene render
+	enum MIRROR_MODE
+	{
+		MIRROR_DISABLED,
+		MIRROR_LEFT_EYE,
+		MIRROR_BOTH_EYES
+	};
+
+	void setMirrorMode(MIRROR_MODE value);
+	MIRROR_MODE getMirrorMode();
+	bool isDesktopRenderSkipped();
+	void composeMirror(wi::graphics::CommandList cmd, const wi::Canvas& canvas);
+
+	//Spectator: extra non VR camera, rendered every N frames at a lower resolution
+	void setSpectatorEnabled(bool value);
+	bool isSpectatorEnabled();
+	void setSpectatorFrameInterval(uint32_t value);
+	void setSpectatorResolution(uint32_t width, uint32_t height);
+	void setSpectatorTransform(const XMMATRIX& world);
+	const wi::graphics::Texture* getSpectatorTexture();
+
+	//Recording of poses, controller states and frame times, and headless replay in place of the runtime
+	bool startRecording(const std::string& fileName);
+	void stopRecording();
+	bool isRecording();
+	bool startReplay(const std::string& fileName);
+	void stopReplay();
+	bool isReplaying();
+	bool isReplayFinished();
+	const char* getSubmitBackendName();
+	uint64_t getSubmittedFrameCount();
+	uint64_t getSubmitDescriptorRebuilds();
+
+	//Streaming of scene chunks around the predicted HMD position, enabled by giving it a loader
+	EngineVrStreaming& getStreaming();
+
+	//Pick rays from the controllers, hits are traced once per frame for both hands and cached per layer/filter mask
+	enum HAND
+	{
+		HAND_LEFT,
+		HAND_RIGHT,
+		HAND_COUNT
+	};
+
+	bool getControllerRay(HAND hand, wi::primitive::Ray& ray);
+	//the returned reference stays valid until the next frame, a combination asked for once 8 others are cached in the frame gets no hit
+	const wi::scene::Scene::RayIntersectionResult& getControllerRayHit(HAND hand, uint32_t layerMask = ~0u, uint32_t filterMask = wi::enums::FILTER_OPAQUE);
+	void setControllerRayLength(float value);
+
+	//Real controller models of the connected hardware instead of the hands, set before startVrSession
+	void setControllerModelsEnabled(bool value);
+	bool isControllerModelsEnabled();
+	void setControllerModelCacheDirectory(const std::string& value);
+
+	//Shadow cache: the VR render paths share shadow maps and only draw them again when a light or a caster near it moved
+	void setShadowCacheEnabled(bool value);
+	bool isShadowCacheEnabled();
+
+	//Input backend, set before startVrSession. Actions fall back to the legacy states when the manifest can't be loaded
+	enum INPUT_BACKEND
+	{
+		INPUT_LEGACY,
+		INPUT_ACTIONS
+	};
+
+	void setInputBackend(INPUT_BACKEND value);
+	INPUT_BACKEND getInputBackend();
+	void setActionManifestPath(const std::string& value);
+	bool isActionInputActive();
+	EngineVrInput& getInput();
+
+	//Overlay layers: HUD/UI textures placed in space by the compositor, redrawn at their own rate
+	EngineVrOverlayLayers& getOverlays();
+
+	//Hands farther than this from the HMD animate at a lower rate
+	void setHandLodDistance(float value);
+
 private:
 	static EngineVrManager* instance;
 
@@ -90,31 +212,68 @@ private:
 	wi::graphics::Texture rtLeftTexture;
 	wi::graphics::Texture rtRightTexture;
 
+	//Per eye targets of the resize and far field composite, kept between frames
+	struct RenderTarget
+	{
+		wi::graphics::Texture texture;
+		wi::graphics::Texture depth;
+		wi::graphics::RenderPass renderPass;
+	};
+
+	RenderTarget resizeTargets[2];
+	RenderTarget compositeTargets[2];
+
+	//Temporaries of the current VR frame
+	EngineVrFrameArena frameArena;
+
 	//Cameras
 	wi::ecs::Entity cameraEntityLeft = wi::ecs::INVALID_ENTITY;
 	wi::ecs::Entity cameraEntityRight = wi::ecs::INVALID_ENTITY;
+	wi::ecs::Entity cameraEntityCenter = wi::ecs::INVALID_ENTITY;
+	wi::ecs::Entity cameraEntitySpectator = wi::ecs::INVALID_ENTITY;
 
 	//hands models
 	wi::ecs::Entity rightHand = wi::ecs::INVALID_ENTITY;
 	wi::ecs::Entity leftHand = wi::ecs::INVALID_ENTITY;
 
 	//RenderPath
-	wi::RenderPath3D renderPathLeft, renderPathRight;
+	wi::RenderPath3D renderPathLeft, renderPathRight, renderPathCenter, renderPathSpectator;
 
 	void updateVrSession(float dt);
 	void RenderRt(vr::Hmd_Eye nEye, float dt);
-	std::string GetTrackedDeviceString(vr::IVRSystem* pHmd, vr::TrackedDeviceIndex_t unDevice, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* peError = nullptr);
+	void RenderFarField(float dt);
+	void updateSpectator(float dt);
+	//the text lives in the frame arena, it is only valid until the next frame starts
+	std::string_view GetTrackedDeviceString(vr::IVRSystem* pHmd, vr::TrackedDeviceIndex_t unDevice, vr::TrackedDeviceProperty prop, vr::TrackedPropertyError* peError = nullptr);
 	XMMATRIX ConvertSteamVRMatrixToXMMATRIX(const vr::HmdMatrix34_t& matPose);
-	XMMATRIX GetHMDMatrixProjectionEye(vr::Hmd_Eye nEye);
+	XMMATRIX ConvertSteamVRProjectionToXMMATRIX(const vr::HmdMatrix44_t& mat);
+	XMMATRIX GetHMDMatrixProjectionEye(vr::Hmd_Eye nEye, float zNear = 0.1f, float zFar = 1000.0f);
+	XMMATRIX GetHMDMatrixProjectionCenter(float zNear, float zFar);
+	vr::HmdMatrix44_t ComposeProjection(float left, float right, float top, float bottom, float zNear, float zFar);
 	XMMATRIX GetHMDMatrixPoseEye(vr::Hmd_Eye nEye);
+	void updateProjections();
+	void createSubmitter();
 	void createVrCameras();
-	void getControllerActions(vr::VRControllerState_t state, int unDevice, float dt);
-	wi::graphics::Texture resizeImage(const wi::graphics::Texture& image, int width, int height);
+	void createFarFieldCamera();
+	void createSpectatorCamera();
+	bool updateVrCamera(wi::ecs::Entity cameraEntity, const XMMATRIX& projectionMatrix, const XMMATRIX& eyePos);
+	void updateHands(int leftIndex, int rightIndex);
+	void updateControllerRays(int leftIndex, int rightIndex);
+	void updateControllerModels(int leftIndex, int rightIndex);
+	void updateStreaming(float dt);
+	void readLiveFrame(float dt);
+	bool readReplayFrame();
+	void getControllerActions(const vr::VRControllerState_t& state, vr::ETrackedControllerRole role, float dt);
+	wi::graphics::Texture resizeImage(const wi::graphics::Texture& image, int width, int height, RenderTarget& target);
+	void drawMirrorEye(const wi::graphics::Texture& image, const XMMATRIX& projectionMatrix, float x, float y, float width, float height, wi::graphics::CommandList cmd);
+	wi::graphics::Texture compositeFarField(const wi::graphics::Texture& nearImage, const wi::graphics::Texture& nearDepth, const wi::graphics::Texture& farImage, const XMFLOAT4& farCrop, RenderTarget& target);
+	void updateFarFieldCrop();
+	void setEyeSkyEnabled(bool value);
 
 	bool isVrRunning = false;
 
-	vr::IVRSystem* hmd;
-	vr::IVRRenderModels* renderModels;
+	vr::IVRSystem* hmd = nullptr;
+	vr::IVRRenderModels* renderModels = nullptr;
 	vr::Hmd_Eye eyes;//vr::Eye_Right
 	vr::TrackedDevicePose_t trackedDevicePose[vr::k_unMaxTrackedDeviceCount];
 	XMMATRIX mat4DevicePose[vr::k_unMaxTrackedDeviceCount];
@@ -123,6 +282,107 @@ private:
 	uint32_t heightTexture = 0;
 
 	XMMATRIX mat4HMDPose, mat4eyePosLeft, mat4ProjectionLeft, mat4ProjectionRight, mat4eyePosRight;
+	XMMATRIX mat4eyePosCenter, mat4ProjectionCenter;
+	float projectionRaw[2][4] = {};
+
+	//Hybrid mono far field
+	bool hybridMono = false;
+	float farFieldSplitDistance = 30.0f;
+	bool farFieldRendered = false;
+	XMFLOAT4 farFieldCrop[2] = { XMFLOAT4(0, 0, 1, 1), XMFLOAT4(0, 0, 1, 1) };
+
+	struct EyeSky
+	{
+		bool realisticSky = false;
+		bool volumetricClouds = false;
+		wi::Resource skyMap;
+	};
+	EyeSky eyeSkySaved;
+	FrameStats frameStats;
+
+	//Desktop mirror
+	MIRROR_MODE mirrorMode = MIRROR_DISABLED;
+	float mirrorCrop = 0.15f;
+
+	//Spectator, work is split in phases so a VR frame never pays for a full extra render
+	enum SPECTATOR_PHASE
+	{
+		SPECTATOR_WAIT,
+		SPECTATOR_CULL,
+		SPECTATOR_RENDER
+	};
+
+	bool spectatorEnabled = false;
+	uint32_t spectatorFrameInterval = 3;
+	uint32_t spectatorWidth = 1280;
+	uint32_t spectatorHeight = 720;
+	uint32_t spectatorFrameCounter = 0;
+	uint32_t spectatorDeferredFrames = 0;
+	uint32_t spectatorObjectCount = 0;
+	float spectatorDt = 0.0f;
+	float spectatorPhaseMs[3] = {};
+	SPECTATOR_PHASE spectatorPhase = SPECTATOR_WAIT;
+	XMFLOAT4X4 spectatorWorld = wi::math::IDENTITY_MATRIX;
+	const wi::graphics::Texture* spectatorTexture = nullptr;
+	float frameBudgetMs = 1000.0f / 90.0f;
+
+	//Recording and replay
+	VrRecordFrame inputFrame;
+	EngineVrRecorder recorder;
+	EngineVrReplay replay;
+	uint32_t vrFrameIndex = 0;
+	uint32_t replayFrameIndex = 0;
+
+	//Streaming
+	EngineVrStreaming streaming;
+	XMFLOAT3 streamingRigPosition = XMFLOAT3(0, 0, 0);
+	bool streamingRigValid = false;
+
+	//Controller rays
+	struct RayCacheEntry
+	{
+		uint32_t layerMask = ~0u;
+		uint32_t filterMask = 0;
+		wi::scene::Scene::RayIntersectionResult results[HAND_COUNT];
+	};
+
+	static const uint32_t rayCacheSize = 8;
+	wi::primitive::Ray controllerRays[HAND_COUNT];
+	bool controllerRayValid[HAND_COUNT] = {};
+	float controllerRayLength = 100.0f;
+	RayCacheEntry rayCache[rayCacheSize];
+	uint32_t rayCacheCount = 0;
+
+	//Controller render models
+	EngineVrRenderModels controllerModels;
+	std::string controllerModelCacheDirectory = "rendermodels";
+	bool controllerModelsEnabled = false;
+	bool controllerModelsActive = false;
+	int controllerModelDevice[HAND_COUNT] = { -1, -1 };
+
+	//Shadow cache
+	EngineVrShadowCache shadowCache;
+
+	//Action input
+	EngineVrInput input;
+	INPUT_BACKEND inputBackend = INPUT_LEGACY;
+	std::string actionManifestPath = "input/actions.json";
+	bool actionInputActive = false;
+
+	//Overlay layers
+	EngineVrOverlayLayers overlays;
+
+	//Hands
+	XMFLOAT4X4 handGripOffset[HAND_COUNT];
+	wi::ecs::Entity handAnimation[HAND_COUNT] = { wi::ecs::INVALID_ENTITY, wi::ecs::INVALID_ENTITY };
+	float handAnimationTime[HAND_COUNT] = {};
+	bool triggerHeld[HAND_COUNT] = {};
+	bool handVisible[HAND_COUNT] = {};
+	bool handNear[HAND_COUNT] = {};
+	uint32_t handLodFrame = 0;
+	uint32_t handLodInterval = 4;
+	float handLodDistance = 1.5f;
+	float handBoundsRadius = 0.15f;
 
 	wi::scene::TransformComponent cameraTransform;
 	XMFLOAT4X4 projection;
@@ -130,5 +390,5 @@ private:
 	wi::scene::Scene* sceneVR;
 
 	Control controllerVR;
-	bool dx12 = false;
+	std::unique_ptr<EngineVrSubmitter> submitter;
 };
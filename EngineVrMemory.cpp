@@ -0,0 +1,189 @@
+#include "WickedEngine.h"
+#include "EngineVrMemory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+EngineVrFrameArena::EngineVrFrameArena(size_t capacity) : memory(new uint8_t[capacity]), capacity(capacity) {}
+
+void* EngineVrFrameArena::allocate(size_t size, size_t alignment)
+{
+	size_t offset = (used + alignment - 1) & ~(alignment - 1);
+	if (offset + size > capacity)
+	{
+		overflows++;
+		return nullptr;
+	}
+
+	used = offset + size;
+	highWater = std::max(highWater, used);
+	return memory.get() + offset;
+}
+
+void EngineVrFrameArena::reset()
+{
+	used = 0;
+}
+
+size_t EngineVrFrameArena::getCapacity() const
+{
+	return capacity;
+}
+
+size_t EngineVrFrameArena::getUsed() const
+{
+	return used;
+}
+
+size_t EngineVrFrameArena::getHighWater() const
+{
+	return highWater;
+}
+
+uint32_t EngineVrFrameArena::getOverflows() const
+{
+	return overflows;
+}
+
+#ifdef ENGINEVR_COUNT_ALLOCATIONS
+
+//plain thread_local values, reading them never allocates
+static thread_local bool threadCounting = false;
+static thread_local uint32_t threadExcluded = 0;
+static thread_local uint64_t threadCount = 0;
+static thread_local uint64_t threadExcludedCount = 0;
+
+static void countAllocation()
+{
+	if (!threadCounting)
+		return;
+
+	if (threadExcluded > 0)
+	{
+		threadExcludedCount++;
+	}
+	else
+	{
+		threadCount++;
+	}
+}
+
+static void* countedAllocate(size_t size)
+{
+	countAllocation();
+	void* pointer = std::malloc(size > 0 ? size : 1);
+	if (pointer == nullptr)
+		throw std::bad_alloc();
+
+	return pointer;
+}
+
+static void* countedAllocateAligned(size_t size, std::align_val_t alignment)
+{
+	countAllocation();
+	size_t align = (size_t)alignment;
+#ifdef _WIN32
+	void* pointer = _aligned_malloc(size > 0 ? size : 1, align);
+#else
+	//aligned_alloc wants a multiple of the alignment
+	void* pointer = std::aligned_alloc(align, std::max(align, (size + align - 1) & ~(align - 1)));
+#endif
+	if (pointer == nullptr)
+		throw std::bad_alloc();
+
+	return pointer;
+}
+
+static void countedFreeAligned(void* pointer)
+{
+#ifdef _WIN32
+	_aligned_free(pointer);
+#else
+	std::free(pointer);
+#endif
+}
+
+void* operator new(size_t size) { return countedAllocate(size); }
+void* operator new[](size_t size) { return countedAllocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedAllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedAllocateAligned(size, alignment); }
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { countedFreeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { countedFreeAligned(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { countedFreeAligned(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { countedFreeAligned(pointer); }
+
+bool EngineVrAllocations::isCounting()
+{
+	return true;
+}
+
+void EngineVrAllocations::beginThread()
+{
+	threadCount = 0;
+	threadExcludedCount = 0;
+	threadCounting = true;
+}
+
+void EngineVrAllocations::endThread()
+{
+	threadCounting = false;
+}
+
+uint64_t EngineVrAllocations::getCount()
+{
+	return threadCount;
+}
+
+uint64_t EngineVrAllocations::getExcludedCount()
+{
+	return threadExcludedCount;
+}
+
+EngineVrAllocations::Excluded::Excluded()
+{
+	threadExcluded++;
+}
+
+EngineVrAllocations::Excluded::~Excluded()
+{
+	threadExcluded--;
+}
+
+#else
+
+bool EngineVrAllocations::isCounting()
+{
+	return false;
+}
+
+void EngineVrAllocations::beginThread()
+{
+}
+
+void EngineVrAllocations::endThread()
+{
+}
+
+uint64_t EngineVrAllocations::getCount()
+{
+	return 0;
+}
+
+uint64_t EngineVrAllocations::getExcludedCount()
+{
+	return 0;
+}
+
+EngineVrAllocations::Excluded::Excluded()
+{
+}
+
+EngineVrAllocations::Excluded::~Excluded()
+{
+}
+
+#endif
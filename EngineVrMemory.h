@@ -0,0 +1,59 @@
+#pragma once
+#include <WickedEngine.h>
+
+#include <cstddef>
+#include <memory>
+
+//Linear allocator for the temporaries of one VR frame: allocations are a pointer bump
+//into memory reserved once, and everything is released together by reset() at the start of the next frame.
+//Nothing is destructed, so only trivially destructible data belongs here.
+class EngineVrFrameArena
+{
+public:
+	explicit EngineVrFrameArena(size_t capacity = 64 * 1024);
+
+	//nullptr when the frame ran out of space, the caller falls back to its own path and the overflow is counted
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	template<typename T>
+	T* allocate(size_t count)
+	{
+		return (T*)allocate(sizeof(T) * count, alignof(T));
+	}
+
+	void reset();
+
+	size_t getCapacity() const;
+	size_t getUsed() const;
+	size_t getHighWater() const;
+	uint32_t getOverflows() const;
+
+private:
+	std::unique_ptr<uint8_t[]> memory;
+	size_t capacity = 0;
+	size_t used = 0;
+	size_t highWater = 0;
+	uint32_t overflows = 0;
+};
+
+//Counts calls to the global operator new on the VR frame thread, to check that a steady state VR frame does not touch the heap.
+//Only the thread between beginThread() and endThread() counts, so worker jobs and other threads never add to it.
+//The replacement operators are only compiled with ENGINEVR_COUNT_ALLOCATIONS defined, otherwise the counts stay 0.
+namespace EngineVrAllocations
+{
+	bool isCounting();
+	//starts counting on the calling thread from 0
+	void beginThread();
+	void endThread();
+	//allocations of the calling thread since beginThread, outside and inside Excluded scopes
+	uint64_t getCount();
+	uint64_t getExcludedCount();
+
+	//Allocations made by Wicked (render paths, image draws) while one is alive are counted apart
+	class Excluded
+	{
+	public:
+		Excluded();
+		~Excluded();
+	};
+}
@@ -0,0 +1,346 @@
+#include "WickedEngine.h"
+#include "EngineVrOverlay.h"
+#include "EngineVrMemory.h"
+#include <cstring>
+
+bool EngineVrRuntimeOverlayApi::createOverlay(const char* key, const char* name, vr::VROverlayHandle_t& handle)
+{
+	return overlay->CreateOverlay(key, name, &handle) == vr::VROverlayError_None;
+}
+
+void EngineVrRuntimeOverlayApi::destroyOverlay(vr::VROverlayHandle_t handle)
+{
+	overlay->DestroyOverlay(handle);
+}
+
+void EngineVrRuntimeOverlayApi::setTexture(vr::VROverlayHandle_t handle, const vr::Texture_t& texture)
+{
+	overlay->SetOverlayTexture(handle, &texture);
+}
+
+void EngineVrRuntimeOverlayApi::setTransform(vr::VROverlayHandle_t handle, const vr::HmdMatrix34_t& transform, bool headRelative)
+{
+	if (headRelative)
+	{
+		overlay->SetOverlayTransformTrackedDeviceRelative(handle, vr::k_unTrackedDeviceIndex_Hmd, &transform);
+	}
+	else
+	{
+		overlay->SetOverlayTransformAbsolute(handle, vr::TrackingUniverseStanding, &transform);
+	}
+}
+
+void EngineVrRuntimeOverlayApi::setWidth(vr::VROverlayHandle_t handle, float meters)
+{
+	overlay->SetOverlayWidthInMeters(handle, meters);
+}
+
+void EngineVrRuntimeOverlayApi::setVisible(vr::VROverlayHandle_t handle, bool visible)
+{
+	if (visible)
+	{
+		overlay->ShowOverlay(handle);
+	}
+	else
+	{
+		overlay->HideOverlay(handle);
+	}
+}
+
+EngineVrOverlayLayers::~EngineVrOverlayLayers()
+{
+	clear();
+}
+
+void EngineVrOverlayLayers::setApi(std::shared_ptr<EngineVrOverlayApi> value)
+{
+	for (Layer& layer : layers)
+	{
+		releaseRuntime(layer);
+	}
+	api = value;
+}
+
+int EngineVrOverlayLayers::createLayer(const LayerDesc& desc, DrawCallback draw)
+{
+	for (uint32_t i = 0; i < maxLayers; ++i)
+	{
+		if (!layers[i].used)
+		{
+			layers[i] = Layer();
+			layers[i].used = true;
+			layers[i].desc = desc;
+			layers[i].draw = draw;
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+int EngineVrOverlayLayers::createLayer(const LayerDesc& desc, wi::RenderPath2D* renderPath)
+{
+	int layer = createLayer(desc, DrawCallback());
+	if (layer >= 0)
+	{
+		layers[layer].renderPath = renderPath;
+	}
+	return layer;
+}
+
+void EngineVrOverlayLayers::destroyLayer(int layer)
+{
+	if (!isLayer(layer))
+		return;
+
+	releaseRuntime(layers[layer]);
+	layers[layer] = Layer();
+}
+
+void EngineVrOverlayLayers::setLayerTransform(int layer, const XMMATRIX& transform)
+{
+	if (!isLayer(layer))
+		return;
+
+	XMStoreFloat4x4(&layers[layer].transform, transform);
+	layers[layer].transformDirty = true;
+}
+
+void EngineVrOverlayLayers::setLayerVisible(int layer, bool visible)
+{
+	if (!isLayer(layer) || layers[layer].visible == visible)
+		return;
+
+	layers[layer].visible = visible;
+	layers[layer].visibilityDirty = true;
+}
+
+void EngineVrOverlayLayers::setLayerDirty(int layer)
+{
+	if (isLayer(layer))
+	{
+		layers[layer].dirty = true;
+	}
+}
+
+void EngineVrOverlayLayers::setLayerUpdateRate(int layer, float updateRate)
+{
+	if (isLayer(layer))
+	{
+		layers[layer].desc.updateRate = updateRate;
+	}
+}
+
+bool EngineVrOverlayLayers::schedule(float updateRate, bool dirty, float dt, float& timeSinceRedraw)
+{
+	timeSinceRedraw += dt;
+
+	//redraw on the frame closest to the due time, so 30 Hz on a 90 Hz display is exactly every third frame
+	bool due = dirty || (updateRate > 0.0f && timeSinceRedraw >= 1.0f / updateRate - 0.5f * dt);
+	if (due)
+	{
+		timeSinceRedraw = 0.0f;
+	}
+	return due;
+}
+
+vr::HmdMatrix34_t EngineVrOverlayLayers::toTrackingMatrix(const XMMATRIX& transform)
+{
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, transform);
+
+	vr::HmdMatrix34_t matrix = {};
+	matrix.m[0][0] = m._11; matrix.m[1][0] = m._12; matrix.m[2][0] = -m._13;
+	matrix.m[0][1] = m._21; matrix.m[1][1] = m._22; matrix.m[2][1] = -m._23;
+	matrix.m[0][2] = -m._31; matrix.m[1][2] = -m._32; matrix.m[2][2] = m._33;
+	matrix.m[0][3] = m._41; matrix.m[1][3] = m._42; matrix.m[2][3] = -m._43;
+
+	return matrix;
+}
+
+void EngineVrOverlayLayers::update(float dt, const XMMATRIX& rigWorld, EngineVrSubmitter* submitter)
+{
+	stats = Stats();
+
+	XMFLOAT4X4 rigCurrent;
+	XMStoreFloat4x4(&rigCurrent, rigWorld);
+	bool rigChanged = std::memcmp(&rigCurrent, &rig, sizeof(rig)) != 0;
+	rig = rigCurrent;
+
+	if (api == nullptr)
+		return;
+
+	XMMATRIX rigInverse = XMMatrixInverse(nullptr, rigWorld);
+
+	for (uint32_t i = 0; i < maxLayers; ++i)
+	{
+		Layer& layer = layers[i];
+		if (!layer.used)
+			continue;
+
+		stats.layers++;
+
+		if (layer.handle == vr::k_ulOverlayHandleInvalid && !createRuntime(layer, i))
+			continue;
+
+		if (layer.visibilityDirty)
+		{
+			api->setVisible(layer.handle, layer.visible);
+			layer.visibilityDirty = false;
+		}
+
+		if (!layer.visible)
+			continue;
+
+		//world anchored layers stay in place when the rig moves
+		if (layer.transformDirty || (layer.desc.anchor == ANCHOR_WORLD && rigChanged))
+		{
+			XMMATRIX transform = XMLoadFloat4x4(&layer.transform);
+			if (layer.desc.anchor == ANCHOR_WORLD)
+			{
+				transform = transform * rigInverse;
+			}
+			api->setTransform(layer.handle, toTrackingMatrix(transform), layer.desc.anchor == ANCHOR_HEAD);
+			layer.transformDirty = false;
+		}
+
+		float elapsed = layer.timeSinceRedraw + dt;
+		if (!schedule(layer.desc.updateRate, layer.dirty, dt, layer.timeSinceRedraw))
+		{
+			stats.skippedRedraws++;
+			continue;
+		}
+
+		if (!redraw(layer, elapsed))
+			continue;
+
+		layer.dirty = false;
+		stats.redraws++;
+
+		vr::Texture_t vrTexture;
+		uint32_t slot = EngineVrSubmitter::SLOT_OVERLAY + i * layerBufferCount + layer.buffer;
+		if (submitter != nullptr && submitter->describe(slot, layer.textures[layer.buffer], vrTexture))
+		{
+			api->setTexture(layer.handle, vrTexture);
+		}
+		layer.buffer = (layer.buffer + 1) % layerBufferCount;
+	}
+}
+
+void EngineVrOverlayLayers::clear()
+{
+	for (uint32_t i = 0; i < maxLayers; ++i)
+	{
+		destroyLayer((int)i);
+	}
+}
+
+const EngineVrOverlayLayers::Stats& EngineVrOverlayLayers::getStats() const
+{
+	return stats;
+}
+
+bool EngineVrOverlayLayers::isLayer(int layer) const
+{
+	return layer >= 0 && layer < (int)maxLayers && layers[layer].used;
+}
+
+void EngineVrOverlayLayers::releaseRuntime(Layer& layer)
+{
+	if (layer.handle != vr::k_ulOverlayHandleInvalid && api != nullptr)
+	{
+		api->destroyOverlay(layer.handle);
+	}
+	layer.handle = vr::k_ulOverlayHandleInvalid;
+}
+
+bool EngineVrOverlayLayers::createRuntime(Layer& layer, uint32_t index)
+{
+	std::string key = "enginevr.layer." + std::to_string(index);
+	if (!api->createOverlay(key.c_str(), layer.desc.name.c_str(), layer.handle))
+	{
+		layer.handle = vr::k_ulOverlayHandleInvalid;
+		return false;
+	}
+
+	api->setWidth(layer.handle, layer.desc.widthInMeters);
+	layer.dirty = true;
+	layer.transformDirty = true;
+	layer.visibilityDirty = true;
+	return true;
+}
+
+bool EngineVrOverlayLayers::redraw(Layer& layer, float dt)
+{
+	wi::graphics::GraphicsDevice* device = wi::graphics::GetDevice();
+	if (device == nullptr)
+		return false;
+
+	if (!layer.textures[0].IsValid())
+	{
+		wi::graphics::TextureDesc desc;
+		desc.width = layer.desc.width;
+		desc.height = layer.desc.height;
+		desc.format = wi::graphics::Format::R8G8B8A8_UNORM;
+		desc.bind_flags = wi::graphics::BindFlag::RENDER_TARGET | wi::graphics::BindFlag::SHADER_RESOURCE;
+		for (uint32_t buffer = 0; buffer < layerBufferCount; ++buffer)
+		{
+			if (!device->CreateTexture(&desc, nullptr, &layer.textures[buffer]))
+			{
+				layer.textures[0] = wi::graphics::Texture();
+				return false;
+			}
+
+			wi::graphics::RenderPassDesc passDesc;
+			passDesc.attachments.push_back(wi::graphics::RenderPassAttachment::RenderTarget(layer.textures[buffer], wi::graphics::RenderPassAttachment::LoadOp::CLEAR));
+			device->CreateRenderPass(&passDesc, &layer.renderPasses[buffer]);
+		}
+
+		if (layer.renderPath != nullptr)
+		{
+			layer.renderPath->width = desc.width;
+			layer.renderPath->height = desc.height;
+			layer.renderPath->ResizeBuffers();
+		}
+	}
+
+	EngineVrAllocations::Excluded excluded;
+
+	//the render path only runs at the layer rate, with the time elapsed since its last redraw
+	if (layer.renderPath != nullptr)
+	{
+		layer.renderPath->PreUpdate();
+		layer.renderPath->Update(dt);
+		layer.renderPath->PostUpdate();
+		layer.renderPath->PreRender();
+		layer.renderPath->Render();
+	}
+
+	wi::graphics::CommandList cmd = device->BeginCommandList();
+
+	device->EventBegin("OverlayLayer", cmd);
+
+	wi::graphics::Viewport vp;
+	vp.width = (float)layer.desc.width;
+	vp.height = (float)layer.desc.height;
+
+	device->BindViewports(1, &vp, cmd);
+	device->RenderPassBegin(&layer.renderPasses[layer.buffer], cmd);
+
+	if (layer.renderPath != nullptr)
+	{
+		layer.renderPath->Compose(cmd);
+	}
+	else if (layer.draw)
+	{
+		layer.draw(cmd);
+	}
+
+	device->RenderPassEnd(cmd);
+
+	device->EventEnd(cmd);
+
+	device->SubmitCommandLists();
+
+	return true;
+}
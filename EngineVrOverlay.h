@@ -0,0 +1,135 @@
+#pragma once
+#include <WickedEngine.h>
+
+#include "openvr.h"
+#include "EngineVrBackend.h"
+
+#include <functional>
+#include <memory>
+
+//The IVROverlay calls the layers need, so the update scheduling can be driven by a mock
+class EngineVrOverlayApi
+{
+public:
+	virtual ~EngineVrOverlayApi() = default;
+
+	virtual bool createOverlay(const char* key, const char* name, vr::VROverlayHandle_t& handle) = 0;
+	virtual void destroyOverlay(vr::VROverlayHandle_t handle) = 0;
+	virtual void setTexture(vr::VROverlayHandle_t handle, const vr::Texture_t& texture) = 0;
+	//absolute tracking space, or relative to the HMD
+	virtual void setTransform(vr::VROverlayHandle_t handle, const vr::HmdMatrix34_t& transform, bool headRelative) = 0;
+	virtual void setWidth(vr::VROverlayHandle_t handle, float meters) = 0;
+	virtual void setVisible(vr::VROverlayHandle_t handle, bool visible) = 0;
+};
+
+class EngineVrRuntimeOverlayApi : public EngineVrOverlayApi
+{
+public:
+	EngineVrRuntimeOverlayApi(vr::IVROverlay* overlay) : overlay(overlay) {}
+
+	bool createOverlay(const char* key, const char* name, vr::VROverlayHandle_t& handle) override;
+	void destroyOverlay(vr::VROverlayHandle_t handle) override;
+	void setTexture(vr::VROverlayHandle_t handle, const vr::Texture_t& texture) override;
+	void setTransform(vr::VROverlayHandle_t handle, const vr::HmdMatrix34_t& transform, bool headRelative) override;
+	void setWidth(vr::VROverlayHandle_t handle, float meters) override;
+	void setVisible(vr::VROverlayHandle_t handle, bool visible) override;
+
+private:
+	vr::IVROverlay* overlay = nullptr;
+};
+
+//2D layers placed in the world by the compositor instead of being drawn into both eyes.
+//A layer texture is only redrawn at its own rate (or when marked dirty), the compositor
+//reprojects it every frame, so it stays sharp and costs nothing in the eye passes.
+//Each layer has two textures: the compositor samples the one last handed to it on its own timeline,
+//so a redraw goes into the other one and never changes the image being shown.
+class EngineVrOverlayLayers
+{
+public:
+	static const uint32_t layerBufferCount = 2;
+	static const uint32_t maxLayers = (EngineVrSubmitter::SLOT_COUNT - EngineVrSubmitter::SLOT_OVERLAY) / layerBufferCount;
+
+	//called inside a render pass on the layer texture
+	typedef std::function<void(wi::graphics::CommandList cmd)> DrawCallback;
+
+	enum ANCHOR
+	{
+		ANCHOR_WORLD,
+		ANCHOR_HEAD
+	};
+
+	struct LayerDesc
+	{
+		std::string name = "Layer";
+		uint32_t width = 1024;
+		uint32_t height = 1024;
+		float widthInMeters = 1.0f;
+		//redraws per second, 0 only redraws when the layer is marked dirty
+		float updateRate = 30.0f;
+		ANCHOR anchor = ANCHOR_WORLD;
+	};
+
+	struct Stats
+	{
+		uint32_t layers = 0;
+		uint32_t redraws = 0;
+		uint32_t skippedRedraws = 0;
+	};
+
+	~EngineVrOverlayLayers();
+
+	//runtime overlays are created on the next update, and all destroyed when the api changes (nullptr at session end)
+	void setApi(std::shared_ptr<EngineVrOverlayApi> value);
+
+	//-1 when all the layers are in use
+	int createLayer(const LayerDesc& desc, DrawCallback draw);
+	//the render path is updated and rendered at the layer rate, then composed into the layer texture
+	int createLayer(const LayerDesc& desc, wi::RenderPath2D* renderPath);
+	void destroyLayer(int layer);
+	//world space for ANCHOR_WORLD, head space for ANCHOR_HEAD
+	void setLayerTransform(int layer, const XMMATRIX& transform);
+	void setLayerVisible(int layer, bool visible);
+	void setLayerDirty(int layer);
+	void setLayerUpdateRate(int layer, float updateRate);
+
+	//rigWorld is the world transform of the tracking space (the VR camera transform)
+	void update(float dt, const XMMATRIX& rigWorld, EngineVrSubmitter* submitter);
+	void clear();
+
+	const Stats& getStats() const;
+
+	//true when a layer must be redrawn this frame, advances and resets its timer
+	static bool schedule(float updateRate, bool dirty, float dt, float& timeSinceRedraw);
+	//inverse of the tracking to world conversion of the manager (right handed tracking space)
+	static vr::HmdMatrix34_t toTrackingMatrix(const XMMATRIX& transform);
+
+private:
+	struct Layer
+	{
+		bool used = false;
+		LayerDesc desc;
+		DrawCallback draw;
+		wi::RenderPath2D* renderPath = nullptr;
+		vr::VROverlayHandle_t handle = vr::k_ulOverlayHandleInvalid;
+		wi::graphics::Texture textures[layerBufferCount];
+		wi::graphics::RenderPass renderPasses[layerBufferCount];
+		//texture the next redraw goes into
+		uint32_t buffer = 0;
+		XMFLOAT4X4 transform = wi::math::IDENTITY_MATRIX;
+		float timeSinceRedraw = 0.0f;
+		bool visible = true;
+		bool dirty = true;
+		bool transformDirty = true;
+		bool visibilityDirty = true;
+	};
+
+	bool isLayer(int layer) const;
+	void releaseRuntime(Layer& layer);
+	bool createRuntime(Layer& layer, uint32_t index);
+	bool redraw(Layer& layer, float dt);
+
+	std::shared_ptr<EngineVrOverlayApi> api;
+	Layer layers[maxLayers];
+	XMFLOAT4X4 rig = wi::math::IDENTITY_MATRIX;
+	Stats stats;
+};
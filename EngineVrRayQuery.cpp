@@ -0,0 +1,317 @@
+#include "WickedEngine.h"
+#include "EngineVrRayQuery.h"
+#include <algorithm>
+
+//Möller-Trumbore, returns the distance along the ray or a negative value
+static float intersectTriangle(const XMVECTOR& origin, const XMVECTOR& direction, const XMVECTOR& v0, const XMVECTOR& edge1, const XMVECTOR& edge2)
+{
+	XMVECTOR p = XMVector3Cross(direction, edge2);
+	float det = XMVectorGetX(XMVector3Dot(edge1, p));
+	if (std::abs(det) < 1e-8f)
+		return -1.0f;
+
+	float invDet = 1.0f / det;
+	XMVECTOR s = XMVectorSubtract(origin, v0);
+	float u = XMVectorGetX(XMVector3Dot(s, p)) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	XMVECTOR q = XMVector3Cross(s, edge1);
+	float v = XMVectorGetX(XMVector3Dot(direction, q)) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+
+	return XMVectorGetX(XMVector3Dot(edge2, q)) * invDet;
+}
+
+//true when the entity or one of its parents is in the list
+static bool isIgnored(const wi::scene::Scene& scene, wi::ecs::Entity entity, const wi::ecs::Entity* ignoreEntities, uint32_t ignoreCount)
+{
+	while (entity != wi::ecs::INVALID_ENTITY)
+	{
+		for (uint32_t i = 0; i < ignoreCount; ++i)
+		{
+			if (entity == ignoreEntities[i])
+				return true;
+		}
+
+		const wi::scene::HierarchyComponent* hierarchy = scene.hierarchy.GetComponent(entity);
+		entity = hierarchy != nullptr ? hierarchy->parentID : wi::ecs::INVALID_ENTITY;
+	}
+	return false;
+}
+
+//Rays of the packet in the space of the mesh being traced, TMax shrinks to the closest hit found so far
+struct PacketTrace
+{
+	const wi::scene::MeshComponent* mesh = nullptr;
+	//skinned meshes are traced against their skinned vertices, their BVH is built on the bind pose
+	const wi::scene::ArmatureComponent* armature = nullptr;
+	uint32_t rayCount = 0;
+	uint32_t activeMask = 0;
+	uint32_t hitMask = 0;
+	wi::primitive::Ray rays[EngineVrRayQuery::maxRays];
+	XMVECTOR origin[EngineVrRayQuery::maxRays];
+	XMVECTOR direction[EngineVrRayQuery::maxRays];
+	int hitSubset[EngineVrRayQuery::maxRays];
+	uint32_t hitTriangle[EngineVrRayQuery::maxRays];
+
+	XMVECTOR loadVertex(uint32_t index) const
+	{
+		if (armature != nullptr)
+			return wi::scene::SkinVertex(*mesh, *armature, index);
+
+		return XMLoadFloat3(&mesh->vertex_positions[index]);
+	}
+
+	void testTriangle(uint32_t subsetIndex, uint32_t index, uint32_t rayMask)
+	{
+		XMVECTOR v0 = loadVertex(mesh->indices[index + 0]);
+		XMVECTOR edge1 = XMVectorSubtract(loadVertex(mesh->indices[index + 1]), v0);
+		XMVECTOR edge2 = XMVectorSubtract(loadVertex(mesh->indices[index + 2]), v0);
+
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			if ((rayMask & (1u << r)) == 0)
+				continue;
+
+			float t = intersectTriangle(origin[r], direction[r], v0, edge1, edge2);
+			if (t >= rays[r].TMin && t < rays[r].TMax)
+			{
+				rays[r].TMax = t;
+				hitMask |= 1u << r;
+				hitSubset[r] = (int)subsetIndex;
+				hitTriangle[r] = index;
+			}
+		}
+	}
+
+	//a node is only visited by the rays that reached its parent, the packet is split when the rays diverge
+	void walk(uint32_t nodeIndex, uint32_t rayMask)
+	{
+		const wi::BVH::Node& node = mesh->bvh.nodes[nodeIndex];
+
+		uint32_t nodeMask = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			if ((rayMask & (1u << r)) && node.aabb.intersects(rays[r]))
+			{
+				nodeMask |= 1u << r;
+			}
+		}
+		if (nodeMask == 0)
+			return;
+
+		if (!node.isLeaf())
+		{
+			walk(node.left, nodeMask);
+			walk(node.left + 1, nodeMask);
+			return;
+		}
+
+		for (uint32_t i = 0; i < node.count; ++i)
+		{
+			//the mesh stores the subset in userdata and the triangle of that subset in layerMask
+			const wi::primitive::AABB& leaf = mesh->bvh_leaf_aabbs[mesh->bvh.leaf_indices[node.offset + i]];
+			const wi::scene::MeshComponent::MeshSubset& subset = mesh->subsets[leaf.userdata];
+			testTriangle(leaf.userdata, subset.indexOffset + leaf.layerMask * 3, nodeMask);
+		}
+	}
+
+	//every triangle of the most detailed LOD, like the mesh BVH
+	void bruteForce()
+	{
+		uint32_t firstSubset = 0;
+		uint32_t lastSubset = 0;
+		mesh->GetLODSubsetRange(0, firstSubset, lastSubset);
+		for (uint32_t subsetIndex = firstSubset; subsetIndex < lastSubset; ++subsetIndex)
+		{
+			const wi::scene::MeshComponent::MeshSubset& subset = mesh->subsets[subsetIndex];
+			for (uint32_t index = subset.indexOffset; index + 2 < subset.indexOffset + subset.indexCount; index += 3)
+			{
+				testTriangle(subsetIndex, index, activeMask);
+			}
+		}
+	}
+};
+
+//World space packet: the scene BVH is walked once for all the rays, objects are reached by the rays that reached their box
+//and each ray keeps the distance of its closest hit, so everything behind it is pruned
+struct SceneTrace
+{
+	const wi::scene::Scene* scene = nullptr;
+	uint32_t filterMask = 0;
+	uint32_t layerMask = 0;
+	const wi::ecs::Entity* ignoreEntities = nullptr;
+	uint32_t ignoreCount = 0;
+	uint32_t rayCount = 0;
+	//TMax is the closest hit so far
+	wi::primitive::Ray rays[EngineVrRayQuery::maxRays];
+	float directionLength[EngineVrRayQuery::maxRays];
+	wi::scene::Scene::RayIntersectionResult* results = nullptr;
+	PacketTrace packet;
+
+	void walk(uint32_t nodeIndex, uint32_t rayMask)
+	{
+		const wi::BVH& bvh = scene->BVH;
+		const wi::BVH::Node& node = bvh.nodes[nodeIndex];
+
+		uint32_t nodeMask = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			if ((rayMask & (1u << r)) && node.aabb.intersects(rays[r]))
+			{
+				nodeMask |= 1u << r;
+			}
+		}
+		if (nodeMask == 0)
+			return;
+
+		if (!node.isLeaf())
+		{
+			//nearer child first, its hits shorten the rays before the other child is tested
+			XMFLOAT3 leftCenter = bvh.nodes[node.left].aabb.getCenter();
+			XMFLOAT3 rightCenter = bvh.nodes[node.left + 1].aabb.getCenter();
+			XMVECTOR origin = XMLoadFloat3(&rays[0].origin);
+			float leftDistance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&leftCenter), origin)));
+			float rightDistance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&rightCenter), origin)));
+			uint32_t first = leftDistance <= rightDistance ? node.left : node.left + 1;
+			walk(first, nodeMask);
+			walk(first == node.left ? node.left + 1 : node.left, nodeMask);
+			return;
+		}
+
+		for (uint32_t i = 0; i < node.count; ++i)
+		{
+			traceObject(bvh.leaf_indices[node.offset + i], nodeMask);
+		}
+	}
+
+	void traceObject(size_t objectIndex, uint32_t rayMask)
+	{
+		if (objectIndex >= scene->objects.GetCount())
+			return;
+
+		const wi::scene::ObjectComponent& object = scene->objects[objectIndex];
+		if (object.meshID == wi::ecs::INVALID_ENTITY || (object.GetFilterMask() & filterMask) == 0)
+			return;
+
+		wi::ecs::Entity entity = scene->objects.GetEntity(objectIndex);
+		const wi::scene::LayerComponent* layer = scene->layers.GetComponent(entity);
+		if (layer != nullptr && (layer->GetLayerMask() & layerMask) == 0)
+			return;
+
+		//object box against the rays shortened by the hits found so far
+		uint32_t activeMask = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			if ((rayMask & (1u << r)) && scene->aabb_objects[objectIndex].intersects(rays[r]))
+			{
+				activeMask |= 1u << r;
+			}
+		}
+		if (activeMask == 0)
+			return;
+
+		if (ignoreCount > 0 && isIgnored(*scene, entity, ignoreEntities, ignoreCount))
+			return;
+
+		const wi::scene::MeshComponent* mesh = scene->meshes.GetComponent(object.meshID);
+		const wi::scene::TransformComponent* transform = scene->transforms.GetComponent(entity);
+		if (mesh == nullptr || transform == nullptr)
+			return;
+
+		XMMATRIX world = XMLoadFloat4x4(&transform->world);
+		XMMATRIX worldInverse = XMMatrixInverse(nullptr, world);
+		packet.mesh = mesh;
+		packet.armature = mesh->IsSkinned() ? scene->armatures.GetComponent(mesh->armatureID) : nullptr;
+		packet.activeMask = activeMask;
+		packet.hitMask = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			if (activeMask & (1u << r))
+			{
+				//the local direction is not normalized, so a distance t along it is the same point as t along the world ray:
+				//the closest world hit bounds the local search
+				packet.origin[r] = XMVector3Transform(XMLoadFloat3(&rays[r].origin), worldInverse);
+				packet.direction[r] = XMVector3TransformNormal(XMLoadFloat3(&rays[r].direction), worldInverse);
+				packet.rays[r] = wi::primitive::Ray(packet.origin[r], packet.direction[r], rays[r].TMin / directionLength[r], rays[r].TMax / directionLength[r]);
+			}
+		}
+
+		//narrow phase, every node and triangle is loaded once for the whole packet
+		if (mesh->bvh.IsValid() && packet.armature == nullptr)
+		{
+			packet.walk(0, activeMask);
+		}
+		else
+		{
+			packet.bruteForce();
+		}
+
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			if ((packet.hitMask & (1u << r)) == 0)
+				continue;
+
+			float localHit = packet.rays[r].TMax;
+			XMVECTOR position = XMVectorMultiplyAdd(XMLoadFloat3(&rays[r].direction), XMVectorReplicate(localHit), XMLoadFloat3(&rays[r].origin));
+			float distance = localHit * directionLength[r];
+
+			uint32_t index = packet.hitTriangle[r];
+			XMVECTOR v0 = packet.loadVertex(mesh->indices[index + 0]);
+			XMVECTOR v1 = packet.loadVertex(mesh->indices[index + 1]);
+			XMVECTOR v2 = packet.loadVertex(mesh->indices[index + 2]);
+			XMVECTOR normal = XMVector3Normalize(XMVector3TransformNormal(XMVector3Cross(XMVectorSubtract(v1, v0), XMVectorSubtract(v2, v0)), world));
+
+			rays[r].TMax = distance;
+			wi::scene::Scene::RayIntersectionResult& result = results[r];
+			result.entity = entity;
+			result.distance = distance;
+			result.subsetIndex = packet.hitSubset[r];
+			result.vertexID0 = (int)mesh->indices[index + 0];
+			result.vertexID1 = (int)mesh->indices[index + 1];
+			result.vertexID2 = (int)mesh->indices[index + 2];
+			XMStoreFloat3(&result.position, position);
+			XMStoreFloat3(&result.normal, normal);
+		}
+	}
+};
+
+void EngineVrRayQuery::trace(const wi::scene::Scene& scene, const wi::primitive::Ray* rays, uint32_t rayCount, uint32_t filterMask, uint32_t layerMask, wi::scene::Scene::RayIntersectionResult* results,
+	const wi::ecs::Entity* ignoreEntities, uint32_t ignoreCount)
+{
+	rayCount = std::min(rayCount, maxRays);
+
+	SceneTrace trace;
+	trace.scene = &scene;
+	trace.filterMask = filterMask;
+	trace.layerMask = layerMask;
+	trace.ignoreEntities = ignoreEntities;
+	trace.ignoreCount = ignoreCount;
+	trace.rayCount = rayCount;
+	trace.results = results;
+	trace.packet.rayCount = rayCount;
+
+	uint32_t rayMask = 0;
+	for (uint32_t r = 0; r < rayCount; ++r)
+	{
+		results[r] = wi::scene::Scene::RayIntersectionResult();
+		trace.rays[r] = rays[r];
+		trace.directionLength[r] = std::max(XMVectorGetX(XMVector3Length(XMLoadFloat3(&rays[r].direction))), 1e-8f);
+		rayMask |= 1u << r;
+	}
+
+	//the scene BVH is built from aabb_objects by Scene::Update, its leaves are object indices
+	if (scene.BVH.IsValid())
+	{
+		trace.walk(0, rayMask);
+	}
+	else
+	{
+		for (size_t i = 0; i < scene.objects.GetCount(); ++i)
+		{
+			trace.traceObject(i, rayMask);
+		}
+	}
+}
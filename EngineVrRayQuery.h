@@ -0,0 +1,19 @@
+#pragma once
+#include <WickedEngine.h>
+
+//Traces a small packet of rays against the scene objects in one pass:
+//the scene BVH is walked once for the whole packet, then the BVH of each mesh reached,
+//each node and each triangle being loaded once and tested against all the rays that reached it.
+//A ray only looks for hits closer than the closest one already found, in the following objects too.
+//Meshes without a BVH (MeshComponent::SetBVHEnabled) fall back to testing every triangle of their first LOD,
+//skinned meshes as well, with their vertices skinned like Scene::Intersects does.
+class EngineVrRayQuery
+{
+public:
+	static const uint32_t maxRays = 8;
+
+	//results[i] is the closest hit of rays[i], entity is INVALID_ENTITY when nothing was hit.
+	//Objects below one of the ignored entities in the hierarchy are skipped (the hands would block their own rays).
+	static void trace(const wi::scene::Scene& scene, const wi::primitive::Ray* rays, uint32_t rayCount, uint32_t filterMask, uint32_t layerMask, wi::scene::Scene::RayIntersectionResult* results,
+		const wi::ecs::Entity* ignoreEntities = nullptr, uint32_t ignoreCount = 0);
+};
@@ -0,0 +1,443 @@
+#include "WickedEngine.h"
+#include "EngineVrRecording.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void VrRecordHeader::setEyeToHead(vr::Hmd_Eye eye, const vr::HmdMatrix34_t& matrix)
+{
+	memcpy(eyeToHead[eye], matrix.m, sizeof(eyeToHead[eye]));
+}
+
+vr::HmdMatrix34_t VrRecordHeader::getEyeToHead(vr::Hmd_Eye eye) const
+{
+	vr::HmdMatrix34_t matrix;
+	memcpy(matrix.m, eyeToHead[eye], sizeof(matrix.m));
+	return matrix;
+}
+
+void VrRecordDevice::setState(const vr::VRControllerState_t& state)
+{
+	packetNum = state.unPacketNum;
+	buttonPressed = state.ulButtonPressed;
+	buttonTouched = state.ulButtonTouched;
+	for (uint32_t i = 0; i < vr::k_unControllerStateAxisCount; ++i)
+	{
+		axis[i][0] = state.rAxis[i].x;
+		axis[i][1] = state.rAxis[i].y;
+	}
+}
+
+vr::VRControllerState_t VrRecordDevice::getState() const
+{
+	vr::VRControllerState_t state = {};
+	state.unPacketNum = packetNum;
+	state.ulButtonPressed = buttonPressed;
+	state.ulButtonTouched = buttonTouched;
+	for (uint32_t i = 0; i < vr::k_unControllerStateAxisCount; ++i)
+	{
+		state.rAxis[i].x = axis[i][0];
+		state.rAxis[i].y = axis[i][1];
+	}
+	return state;
+}
+
+void VrRecordDevice::setPose(const vr::TrackedDevicePose_t& pose)
+{
+	memcpy(deviceToAbsolute, pose.mDeviceToAbsoluteTracking.m, sizeof(deviceToAbsolute));
+	memcpy(velocity, pose.vVelocity.v, sizeof(velocity));
+	memcpy(angularVelocity, pose.vAngularVelocity.v, sizeof(angularVelocity));
+	trackingResult = pose.eTrackingResult;
+	poseIsValid = pose.bPoseIsValid ? 1 : 0;
+	deviceIsConnected = pose.bDeviceIsConnected ? 1 : 0;
+}
+
+vr::TrackedDevicePose_t VrRecordDevice::getPose() const
+{
+	vr::TrackedDevicePose_t pose = {};
+	memcpy(pose.mDeviceToAbsoluteTracking.m, deviceToAbsolute, sizeof(deviceToAbsolute));
+	memcpy(pose.vVelocity.v, velocity, sizeof(velocity));
+	memcpy(pose.vAngularVelocity.v, angularVelocity, sizeof(angularVelocity));
+	pose.eTrackingResult = (vr::ETrackingResult)trackingResult;
+	pose.bPoseIsValid = poseIsValid != 0;
+	pose.bDeviceIsConnected = deviceIsConnected != 0;
+	return pose;
+}
+
+EngineVrRecorder::~EngineVrRecorder()
+{
+	stop();
+}
+
+bool EngineVrRecorder::start(const std::string& fileName, const VrRecordHeader& header)
+{
+	stop();
+
+	file = fopen(fileName.c_str(), "wb");
+	if (file == nullptr)
+	{
+		wi::backlog::post("Failed to open VR recording file " + fileName, wi::backlog::LogLevel::Error);
+		return false;
+	}
+
+	VrRecordHeader fileHeader = header;
+	fileHeader.magic = VR_RECORD_MAGIC;
+	fileHeader.version = VR_RECORD_VERSION;
+	fileHeader.deviceSize = sizeof(VrRecordDevice);
+	fwrite(&fileHeader, sizeof(fileHeader), 1, file);
+	fileOffset = sizeof(fileHeader);
+	frameOffsets.clear();
+
+	//every block the frame thread will ever touch is allocated here
+	blocks.resize(blockCount);
+	for (Block& block : blocks)
+	{
+		block.count = 0;
+		block.used = 0;
+	}
+	producedBlocks.store(0);
+	consumedBlocks.store(0);
+	droppedFrames.store(0);
+	stopping.store(false);
+
+	writer = std::thread(&EngineVrRecorder::writerThread, this);
+	return true;
+}
+
+void EngineVrRecorder::stop()
+{
+	if (file == nullptr)
+		return;
+
+	//publish the partially filled block so the writer flushes it before exiting
+	uint64_t produced = producedBlocks.load(std::memory_order_relaxed);
+	if (produced - consumedBlocks.load(std::memory_order_acquire) < blockCount)
+	{
+		Block& block = blocks[produced % blockCount];
+		if (block.count > 0)
+		{
+			producedBlocks.store(produced + 1, std::memory_order_release);
+		}
+	}
+
+	stopping.store(true);
+	wake.notify_one();
+	if (writer.joinable())
+	{
+		writer.join();
+	}
+
+	//frames the ring could not hand over to the writer, in a block that never got published
+	produced = producedBlocks.load();
+	if (produced - consumedBlocks.load() < blockCount)
+	{
+		Block& block = blocks[produced % blockCount];
+		droppedFrames.fetch_add(block.count);
+		block.count = 0;
+		block.used = 0;
+	}
+
+	VrRecordIndex index;
+	index.indexOffset = fileOffset;
+	index.frameCount = (uint32_t)frameOffsets.size();
+	fwrite(frameOffsets.data(), sizeof(uint64_t), frameOffsets.size(), file);
+	fwrite(&index, sizeof(index), 1, file);
+	frameOffsets.clear();
+
+	fclose(file);
+	file = nullptr;
+
+	if (droppedFrames.load() > 0)
+	{
+		wi::backlog::post("VR recording dropped " + std::to_string(droppedFrames.load()) + " frames", wi::backlog::LogLevel::Warning);
+	}
+}
+
+bool EngineVrRecorder::isRecording() const
+{
+	return file != nullptr;
+}
+
+void EngineVrRecorder::push(const VrRecordFrame& frame)
+{
+	if (file == nullptr)
+		return;
+
+	uint64_t produced = producedBlocks.load(std::memory_order_relaxed);
+	if (produced - consumedBlocks.load(std::memory_order_acquire) >= blockCount)
+	{
+		//writer is behind and every block is waiting for the disk
+		droppedFrames.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	uint32_t deviceCount = std::min(frame.deviceCount, VR_RECORD_MAX_DEVICES);
+	size_t frameSize = getVrRecordFrameSize(deviceCount);
+
+	Block* block = &blocks[produced % blockCount];
+	if (block->used + frameSize > blockSize)
+	{
+		//hand the full block to the writer and continue in the next one
+		producedBlocks.store(produced + 1, std::memory_order_release);
+		wake.notify_one();
+
+		produced++;
+		if (produced - consumedBlocks.load(std::memory_order_acquire) >= blockCount)
+		{
+			droppedFrames.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		block = &blocks[produced % blockCount];
+	}
+
+	uint8_t* destination = block->data + block->used;
+	memcpy(destination, &frame, VR_RECORD_FRAME_HEADER_SIZE);
+	memcpy(destination + offsetof(VrRecordFrame, deviceCount), &deviceCount, sizeof(deviceCount));
+	memcpy(destination + VR_RECORD_FRAME_HEADER_SIZE, frame.devices, deviceCount * sizeof(VrRecordDevice));
+	block->used += (uint32_t)frameSize;
+	block->count++;
+}
+
+uint32_t EngineVrRecorder::getDroppedFrames() const
+{
+	return droppedFrames.load();
+}
+
+void EngineVrRecorder::writerThread()
+{
+	while (true)
+	{
+		uint64_t consumed = consumedBlocks.load(std::memory_order_relaxed);
+		if (consumed == producedBlocks.load(std::memory_order_acquire))
+		{
+			if (stopping.load())
+				break;
+
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait_for(lock, std::chrono::milliseconds(10));
+			continue;
+		}
+
+		Block& block = blocks[consumed % blockCount];
+		fwrite(block.data, 1, block.used, file);
+
+		//index of the frames written, walked from their device counts
+		uint32_t position = 0;
+		for (uint32_t i = 0; i < block.count; ++i)
+		{
+			uint32_t deviceCount;
+			memcpy(&deviceCount, block.data + position + offsetof(VrRecordFrame, deviceCount), sizeof(deviceCount));
+			frameOffsets.push_back(fileOffset + position);
+			position += (uint32_t)getVrRecordFrameSize(deviceCount);
+		}
+		fileOffset += block.used;
+
+		block.count = 0;
+		block.used = 0;
+		consumedBlocks.store(consumed + 1, std::memory_order_release);
+	}
+
+	fflush(file);
+}
+
+EngineVrReplay::~EngineVrReplay()
+{
+	close();
+}
+
+bool EngineVrReplay::open(const std::string& fileName)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE fileWin = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileWin == INVALID_HANDLE_VALUE)
+	{
+		wi::backlog::post("Failed to open VR replay file " + fileName, wi::backlog::LogLevel::Error);
+		return false;
+	}
+	fileHandle = fileWin;
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileWin, &fileSize);
+	size = (size_t)fileSize.QuadPart;
+
+	mappingHandle = CreateFileMappingA(fileWin, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle != nullptr)
+	{
+		data = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+	{
+		wi::backlog::post("Failed to open VR replay file " + fileName, wi::backlog::LogLevel::Error);
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) == 0)
+	{
+		size = (size_t)fileStat.st_size;
+		void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (mapped != MAP_FAILED)
+		{
+			data = (const uint8_t*)mapped;
+			madvise(mapped, size, MADV_SEQUENTIAL);
+		}
+	}
+#endif
+
+	if (data == nullptr || size < sizeof(VrRecordHeader))
+	{
+		wi::backlog::post("Failed to map VR replay file " + fileName, wi::backlog::LogLevel::Error);
+		close();
+		return false;
+	}
+
+	const VrRecordHeader& header = getHeader();
+	if (header.magic != VR_RECORD_MAGIC || header.version != VR_RECORD_VERSION || header.deviceSize != sizeof(VrRecordDevice))
+	{
+		wi::backlog::post("VR replay file " + fileName + " has an unsupported format", wi::backlog::LogLevel::Error);
+		close();
+		return false;
+	}
+
+	if (!readIndex())
+	{
+		//recording that was not stopped (crash), the frames written so far are still usable
+		wi::backlog::post("VR replay file " + fileName + " has no frame index, scanning it", wi::backlog::LogLevel::Warning);
+		scanFrames();
+	}
+	return true;
+}
+
+bool EngineVrReplay::readIndex()
+{
+	if (size < sizeof(VrRecordHeader) + sizeof(VrRecordIndex))
+		return false;
+
+	VrRecordIndex index;
+	memcpy(&index, data + size - sizeof(VrRecordIndex), sizeof(index));
+	if (index.magic != VR_RECORD_INDEX_MAGIC || index.indexOffset < sizeof(VrRecordHeader) || index.indexOffset % sizeof(uint64_t) != 0 ||
+		index.indexOffset + (uint64_t)index.frameCount * sizeof(uint64_t) + sizeof(VrRecordIndex) != size)
+		return false;
+
+	framesEnd = (size_t)index.indexOffset;
+	frameCount = index.frameCount;
+	frameOffsets = (const uint64_t*)(data + framesEnd);
+	return true;
+}
+
+void EngineVrReplay::scanFrames()
+{
+	scannedOffsets.clear();
+	size_t offset = sizeof(VrRecordHeader);
+	while (offset + VR_RECORD_FRAME_HEADER_SIZE <= size)
+	{
+		uint32_t deviceCount;
+		memcpy(&deviceCount, data + offset + offsetof(VrRecordFrame, deviceCount), sizeof(deviceCount));
+		size_t frameSize = getVrRecordFrameSize(deviceCount);
+		if (deviceCount > VR_RECORD_MAX_DEVICES || offset + frameSize > size)
+			break;
+
+		scannedOffsets.push_back(offset);
+		offset += frameSize;
+	}
+
+	framesEnd = offset;
+	frameCount = (uint32_t)scannedOffsets.size();
+	frameOffsets = scannedOffsets.data();
+}
+
+void EngineVrReplay::close()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle != nullptr)
+	{
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+	}
+	if (fileHandle != nullptr)
+	{
+		CloseHandle(fileHandle);
+		fileHandle = nullptr;
+	}
+#else
+	if (data != nullptr)
+	{
+		munmap((void*)data, size);
+	}
+	if (fileDescriptor >= 0)
+	{
+		::close(fileDescriptor);
+		fileDescriptor = -1;
+	}
+#endif
+
+	data = nullptr;
+	size = 0;
+	framesEnd = 0;
+	frameCount = 0;
+	frameOffsets = nullptr;
+	scannedOffsets.clear();
+}
+
+bool EngineVrReplay::isOpen() const
+{
+	return data != nullptr;
+}
+
+const VrRecordHeader& EngineVrReplay::getHeader() const
+{
+	return *(const VrRecordHeader*)data;
+}
+
+uint32_t EngineVrReplay::getFrameCount() const
+{
+	return frameCount;
+}
+
+bool EngineVrReplay::getFrame(uint32_t index, VrRecordFrame& frame) const
+{
+	if (index >= frameCount)
+		return false;
+
+	uint64_t offset = frameOffsets[index];
+	if (offset < sizeof(VrRecordHeader) || offset + VR_RECORD_FRAME_HEADER_SIZE > framesEnd)
+		return false;
+
+	uint32_t deviceCount;
+	memcpy(&deviceCount, data + offset + offsetof(VrRecordFrame, deviceCount), sizeof(deviceCount));
+	size_t frameSize = getVrRecordFrameSize(deviceCount);
+	if (deviceCount > VR_RECORD_MAX_DEVICES || offset + frameSize > framesEnd)
+		return false;
+
+	memcpy(&frame, data + offset, frameSize);
+	return true;
+}
+
+bool EngineVrReplay::getFrameDt(uint32_t index, float& dt) const
+{
+	if (index >= frameCount)
+		return false;
+
+	uint64_t offset = frameOffsets[index];
+	if (offset < sizeof(VrRecordHeader) || offset + VR_RECORD_FRAME_HEADER_SIZE > framesEnd)
+		return false;
+
+	memcpy(&dt, data + offset + offsetof(VrRecordFrame, dt), sizeof(dt));
+	return true;
+}
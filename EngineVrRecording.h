@@ -0,0 +1,175 @@
+#pragma once
+#include <WickedEngine.h>
+
+#include "openvr.h"
+
+#include <atomic>
+#include <cstddef>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+//Binary capture of what the VR runtime gave us each frame.
+//A frame only holds the devices the session uses (HMD, controllers, trackers): its 16 byte header
+//followed by deviceCount device records, so three devices at 90 Hz make about 160 MB per hour.
+//stop() appends the offset of every frame and a VrRecordIndex, so a replay can jump to any frame by index.
+
+static const uint32_t VR_RECORD_MAGIC = 0x52525657;//"WVRR"
+static const uint32_t VR_RECORD_INDEX_MAGIC = 0x49525657;//"WVRI"
+static const uint32_t VR_RECORD_VERSION = 3;
+static const uint32_t VR_RECORD_MAX_DEVICES = vr::k_unMaxTrackedDeviceCount;
+
+//Only fixed width fields, no OpenVR structs: openvr.h packs them differently per platform,
+//a capture made on Windows must replay on Linux.
+
+struct VrRecordHeader
+{
+	uint32_t magic = VR_RECORD_MAGIC;
+	uint32_t version = VR_RECORD_VERSION;
+	uint32_t deviceSize = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	float displayFrequency = 0.0f;
+	float projectionRaw[2][4] = {};//left, right, top, bottom tangents per eye
+	float eyeToHead[2][3][4] = {};
+
+	void setEyeToHead(vr::Hmd_Eye eye, const vr::HmdMatrix34_t& matrix);
+	vr::HmdMatrix34_t getEyeToHead(vr::Hmd_Eye eye) const;
+};
+
+struct VrRecordDevice
+{
+	//controller state
+	uint64_t buttonPressed = 0;
+	uint64_t buttonTouched = 0;
+	float axis[vr::k_unControllerStateAxisCount][2] = {};
+	uint32_t packetNum = 0;
+
+	//pose
+	float deviceToAbsolute[3][4] = {};
+	float velocity[3] = {};
+	float angularVelocity[3] = {};
+	int32_t trackingResult = 0;
+	uint32_t poseIsValid = 0;
+	uint32_t deviceIsConnected = 0;
+
+	uint32_t index = 0;
+	int32_t deviceClass = vr::TrackedDeviceClass_Invalid;
+	int32_t role = vr::TrackedControllerRole_Invalid;
+	uint32_t hasState = 0;
+
+	void setState(const vr::VRControllerState_t& state);
+	vr::VRControllerState_t getState() const;
+	void setPose(const vr::TrackedDevicePose_t& pose);
+	vr::TrackedDevicePose_t getPose() const;
+};
+
+struct VrRecordFrame
+{
+	uint32_t frameIndex = 0;
+	float dt = 0.0f;
+	uint32_t deviceCount = 0;
+	uint32_t padding = 0;
+	VrRecordDevice devices[VR_RECORD_MAX_DEVICES];
+};
+
+//Last bytes of a recording, frameCount offsets (uint64_t from the start of the file) are stored at indexOffset
+struct VrRecordIndex
+{
+	uint64_t indexOffset = 0;
+	uint32_t frameCount = 0;
+	uint32_t magic = VR_RECORD_INDEX_MAGIC;
+};
+
+static const size_t VR_RECORD_FRAME_HEADER_SIZE = 16;
+
+//size of a frame in the file
+inline size_t getVrRecordFrameSize(uint32_t deviceCount)
+{
+	return VR_RECORD_FRAME_HEADER_SIZE + (size_t)deviceCount * sizeof(VrRecordDevice);
+}
+
+static_assert(sizeof(VrRecordHeader) == 152, "VR record header layout changed");
+static_assert(sizeof(VrRecordDevice) == 160, "VR record device layout changed");
+static_assert(offsetof(VrRecordFrame, devices) == VR_RECORD_FRAME_HEADER_SIZE, "VR record frame layout changed");
+static_assert(sizeof(VrRecordIndex) == 16, "VR record index layout changed");
+
+//Append only writer. push() is called on the frame thread and never allocates or waits,
+//full blocks are written to disk by a background thread. Frames are dropped (and counted) if the disk can't keep up.
+class EngineVrRecorder
+{
+public:
+	EngineVrRecorder() = default;
+	~EngineVrRecorder();
+
+	bool start(const std::string& fileName, const VrRecordHeader& header);
+	void stop();
+	bool isRecording() const;
+	void push(const VrRecordFrame& frame);
+	uint32_t getDroppedFrames() const;
+
+private:
+	//a block always has room for one frame with every device
+	static const uint32_t blockSize = 64 * 1024;
+	static const uint32_t blockCount = 8;
+	static_assert(blockSize >= sizeof(VrRecordFrame), "VR record block too small for a full frame");
+
+	struct Block
+	{
+		uint32_t count = 0;
+		uint32_t used = 0;
+		uint8_t data[blockSize];
+	};
+
+	void writerThread();
+
+	wi::vector<Block> blocks;
+	//owned by the writer thread until it is joined
+	wi::vector<uint64_t> frameOffsets;
+	uint64_t fileOffset = 0;
+	std::atomic<uint64_t> producedBlocks{ 0 };
+	std::atomic<uint64_t> consumedBlocks{ 0 };
+	std::atomic<uint32_t> droppedFrames{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	std::thread writer;
+	FILE* file = nullptr;
+};
+
+//Memory mapped reader for a file written by EngineVrRecorder
+class EngineVrReplay
+{
+public:
+	EngineVrReplay() = default;
+	~EngineVrReplay();
+
+	bool open(const std::string& fileName);
+	void close();
+	bool isOpen() const;
+	const VrRecordHeader& getHeader() const;
+	uint32_t getFrameCount() const;
+	//false when the index is past the end or the frame is truncated
+	bool getFrame(uint32_t index, VrRecordFrame& frame) const;
+	bool getFrameDt(uint32_t index, float& dt) const;
+
+private:
+	bool readIndex();
+	void scanFrames();
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	//end of the frame records, the index starts there
+	size_t framesEnd = 0;
+	uint32_t frameCount = 0;
+	const uint64_t* frameOffsets = nullptr;
+	//only used for a file without index
+	wi::vector<uint64_t> scannedOffsets;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+};
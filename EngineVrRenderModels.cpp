@@ -0,0 +1,563 @@
+#include "WickedEngine.h"
+#include "EngineVrRenderModels.h"
+#include <cstring>
+#include <filesystem>
+
+static const uint32_t RENDER_MODEL_CACHE_MAGIC = 0x4D525657;//"WVRM"
+static const uint32_t RENDER_MODEL_CACHE_VERSION = 2;
+
+struct RenderModelCacheHeader
+{
+	uint32_t magic = RENDER_MODEL_CACHE_MAGIC;
+	uint32_t version = RENDER_MODEL_CACHE_VERSION;
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+	uint32_t textureWidth = 0;
+	uint32_t textureHeight = 0;
+	uint32_t textureFormat = vr::VRRenderModelTextureFormat_RGBA8_SRGB;
+};
+
+vr::EVRRenderModelError EngineVrRuntimeRenderModelProvider::loadRenderModel(const char* name, vr::RenderModel_t** model)
+{
+	return renderModels->LoadRenderModel_Async(name, model);
+}
+
+vr::EVRRenderModelError EngineVrRuntimeRenderModelProvider::loadTexture(vr::TextureID_t id, vr::RenderModel_TextureMap_t** texture)
+{
+	return renderModels->LoadTexture_Async(id, texture);
+}
+
+void EngineVrRuntimeRenderModelProvider::freeRenderModel(vr::RenderModel_t* model)
+{
+	renderModels->FreeRenderModel(model);
+}
+
+void EngineVrRuntimeRenderModelProvider::freeTexture(vr::RenderModel_TextureMap_t* texture)
+{
+	renderModels->FreeTexture(texture);
+}
+
+EngineVrRenderModels::~EngineVrRenderModels()
+{
+	clear();
+}
+
+void EngineVrRenderModels::setProvider(std::shared_ptr<EngineVrRenderModelProvider> value)
+{
+	clear();
+	provider = value;
+}
+
+void EngineVrRenderModels::setScene(wi::scene::Scene* value)
+{
+	clear();
+	scene = value;
+}
+
+void EngineVrRenderModels::setCacheDirectory(const std::string& value)
+{
+	cacheDirectory = value;
+}
+
+const EngineVrRenderModels::Stats& EngineVrRenderModels::getStats() const
+{
+	return stats;
+}
+
+std::string EngineVrRenderModels::getCacheFileName(const std::string& name) const
+{
+	std::string fileName = name;
+	for (char& c : fileName)
+	{
+		if (!isalnum((unsigned char)c) && c != '_' && c != '-')
+		{
+			c = '_';
+		}
+	}
+	return cacheDirectory + "/" + fileName + ".wirm";
+}
+
+bool EngineVrRenderModels::getTextureLayout(vr::EVRRenderModelTextureFormat format, uint32_t width, uint32_t height, wi::graphics::Format& wickedFormat, uint32_t& rowPitch, size_t& size)
+{
+	//bytes per pixel, or per 4x4 block for the block compressed formats
+	uint32_t blockBytes = 0;
+	uint32_t blockSize = 1;
+	switch (format)
+	{
+	case vr::VRRenderModelTextureFormat_RGBA8_SRGB:
+		wickedFormat = wi::graphics::Format::R8G8B8A8_UNORM_SRGB;
+		blockBytes = 4;
+		break;
+	case vr::VRRenderModelTextureFormat_BC2:
+		wickedFormat = wi::graphics::Format::BC2_UNORM;
+		blockBytes = 16;
+		blockSize = 4;
+		break;
+	case vr::VRRenderModelTextureFormat_BC4:
+		wickedFormat = wi::graphics::Format::BC4_UNORM;
+		blockBytes = 8;
+		blockSize = 4;
+		break;
+	case vr::VRRenderModelTextureFormat_BC7:
+		wickedFormat = wi::graphics::Format::BC7_UNORM;
+		blockBytes = 16;
+		blockSize = 4;
+		break;
+	case vr::VRRenderModelTextureFormat_BC7_SRGB:
+		wickedFormat = wi::graphics::Format::BC7_UNORM_SRGB;
+		blockBytes = 16;
+		blockSize = 4;
+		break;
+	case vr::VRRenderModelTextureFormat_RGBA16_FLOAT:
+		wickedFormat = wi::graphics::Format::R16G16B16A16_FLOAT;
+		blockBytes = 8;
+		break;
+	default:
+		return false;
+	}
+
+	uint32_t blocksX = (width + blockSize - 1) / blockSize;
+	uint32_t blocksY = (height + blockSize - 1) / blockSize;
+	rowPitch = blocksX * blockBytes;
+	size = (size_t)rowPitch * blocksY;
+	return true;
+}
+
+//OpenVR models are right handed: flip z and the winding
+bool EngineVrRenderModels::convert(const vr::RenderModel_t& model, const vr::RenderModel_TextureMap_t* texture, Data& data)
+{
+	if (model.rVertexData == nullptr || model.rIndexData == nullptr || model.unVertexCount == 0 || model.unTriangleCount == 0)
+		return false;
+
+	data.positions.resize(model.unVertexCount);
+	data.normals.resize(model.unVertexCount);
+	data.uvs.resize(model.unVertexCount);
+	for (uint32_t i = 0; i < model.unVertexCount; ++i)
+	{
+		const vr::RenderModel_Vertex_t& vertex = model.rVertexData[i];
+		data.positions[i] = XMFLOAT3(vertex.vPosition.v[0], vertex.vPosition.v[1], -vertex.vPosition.v[2]);
+		data.normals[i] = XMFLOAT3(vertex.vNormal.v[0], vertex.vNormal.v[1], -vertex.vNormal.v[2]);
+		data.uvs[i] = XMFLOAT2(vertex.rfTextureCoord[0], vertex.rfTextureCoord[1]);
+	}
+
+	data.indices.resize(model.unTriangleCount * 3);
+	for (uint32_t i = 0; i < model.unTriangleCount; ++i)
+	{
+		data.indices[i * 3 + 0] = model.rIndexData[i * 3 + 0];
+		data.indices[i * 3 + 1] = model.rIndexData[i * 3 + 2];
+		data.indices[i * 3 + 2] = model.rIndexData[i * 3 + 1];
+	}
+
+	data.textureWidth = 0;
+	data.textureHeight = 0;
+	data.textureFormat = vr::VRRenderModelTextureFormat_RGBA8_SRGB;
+	data.texture.clear();
+	if (texture != nullptr && texture->rubTextureMapData != nullptr)
+	{
+		wi::graphics::Format wickedFormat;
+		uint32_t rowPitch;
+		size_t size;
+		if (getTextureLayout(texture->format, texture->unWidth, texture->unHeight, wickedFormat, rowPitch, size))
+		{
+			data.textureWidth = texture->unWidth;
+			data.textureHeight = texture->unHeight;
+			data.textureFormat = texture->format;
+			data.texture.resize(size);
+			memcpy(data.texture.data(), texture->rubTextureMapData, size);
+		}
+		else
+		{
+			wi::backlog::post("Render model texture format " + std::to_string((int)texture->format) + " is not supported", wi::backlog::LogLevel::Warning);
+		}
+	}
+
+	return true;
+}
+
+//Header followed by the raw arrays, read back with a single file read
+bool EngineVrRenderModels::writeCache(const std::string& fileName, const Data& data)
+{
+	RenderModelCacheHeader header;
+	header.vertexCount = (uint32_t)data.positions.size();
+	header.indexCount = (uint32_t)data.indices.size();
+	header.textureWidth = data.textureWidth;
+	header.textureHeight = data.textureHeight;
+	header.textureFormat = (uint32_t)data.textureFormat;
+
+	wi::vector<uint8_t> file;
+	file.reserve(sizeof(header) + header.vertexCount * (sizeof(XMFLOAT3) * 2 + sizeof(XMFLOAT2)) + header.indexCount * sizeof(uint32_t) + data.texture.size());
+
+	auto append = [&](const void* source, size_t size) {
+		const uint8_t* bytes = (const uint8_t*)source;
+		file.insert(file.end(), bytes, bytes + size);
+	};
+	append(&header, sizeof(header));
+	append(data.positions.data(), data.positions.size() * sizeof(XMFLOAT3));
+	append(data.normals.data(), data.normals.size() * sizeof(XMFLOAT3));
+	append(data.uvs.data(), data.uvs.size() * sizeof(XMFLOAT2));
+	append(data.indices.data(), data.indices.size() * sizeof(uint32_t));
+	append(data.texture.data(), data.texture.size());
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(fileName).parent_path(), error);
+	return wi::helper::FileWrite(fileName, file.data(), file.size());
+}
+
+bool EngineVrRenderModels::readCache(const std::string& fileName, Data& data)
+{
+	wi::vector<uint8_t> file;
+	if (!wi::helper::FileRead(fileName, file) || file.size() < sizeof(RenderModelCacheHeader))
+		return false;
+
+	RenderModelCacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (header.magic != RENDER_MODEL_CACHE_MAGIC || header.version != RENDER_MODEL_CACHE_VERSION)
+		return false;
+
+	wi::graphics::Format wickedFormat;
+	uint32_t rowPitch;
+	size_t textureSize;
+	if (!getTextureLayout((vr::EVRRenderModelTextureFormat)header.textureFormat, header.textureWidth, header.textureHeight, wickedFormat, rowPitch, textureSize))
+		return false;
+
+	size_t expected = sizeof(header) + (size_t)header.vertexCount * (sizeof(XMFLOAT3) * 2 + sizeof(XMFLOAT2)) + (size_t)header.indexCount * sizeof(uint32_t) + textureSize;
+	if (file.size() != expected)
+		return false;
+
+	size_t offset = sizeof(header);
+	auto read = [&](void* destination, size_t size) {
+		memcpy(destination, file.data() + offset, size);
+		offset += size;
+	};
+
+	data.positions.resize(header.vertexCount);
+	data.normals.resize(header.vertexCount);
+	data.uvs.resize(header.vertexCount);
+	data.indices.resize(header.indexCount);
+	data.texture.resize(textureSize);
+	data.textureWidth = header.textureWidth;
+	data.textureHeight = header.textureHeight;
+	data.textureFormat = (vr::EVRRenderModelTextureFormat)header.textureFormat;
+
+	read(data.positions.data(), data.positions.size() * sizeof(XMFLOAT3));
+	read(data.normals.data(), data.normals.size() * sizeof(XMFLOAT3));
+	read(data.uvs.data(), data.uvs.size() * sizeof(XMFLOAT2));
+	read(data.indices.data(), data.indices.size() * sizeof(uint32_t));
+	read(data.texture.data(), data.texture.size());
+
+	return true;
+}
+
+//Called from a worker job, everything is created in a staging scene merged later on the frame thread
+wi::ecs::Entity EngineVrRenderModels::buildEntity(const std::string& name, const Data& data, wi::scene::Scene& scene)
+{
+	wi::ecs::Entity root = wi::ecs::CreateEntity();
+	scene.transforms.Create(root);
+	scene.names.Create(root) = name;
+
+	wi::ecs::Entity materialEntity = scene.Entity_CreateMaterial(name + "_material");
+	wi::graphics::Format format;
+	uint32_t rowPitch;
+	size_t textureSize;
+	if (!data.texture.empty() && getTextureLayout(data.textureFormat, data.textureWidth, data.textureHeight, format, rowPitch, textureSize) && textureSize == data.texture.size())
+	{
+		wi::graphics::TextureDesc desc;
+		desc.width = data.textureWidth;
+		desc.height = data.textureHeight;
+		desc.format = format;
+		desc.bind_flags = wi::graphics::BindFlag::SHADER_RESOURCE;
+
+		wi::graphics::SubresourceData initData;
+		initData.data_ptr = data.texture.data();
+		initData.row_pitch = rowPitch;
+
+		wi::graphics::Texture texture;
+		if (wi::graphics::GetDevice()->CreateTexture(&desc, &initData, &texture))
+		{
+			wi::scene::MaterialComponent* material = scene.materials.GetComponent(materialEntity);
+			material->textures[wi::scene::MaterialComponent::BASECOLORMAP].resource.SetTexture(texture);
+		}
+	}
+
+	wi::ecs::Entity meshEntity = scene.Entity_CreateMesh(name + "_mesh");
+	wi::scene::MeshComponent* mesh = scene.meshes.GetComponent(meshEntity);
+	mesh->vertex_positions = data.positions;
+	mesh->vertex_normals = data.normals;
+	mesh->vertex_uvset_0 = data.uvs;
+	mesh->indices = data.indices;
+	wi::scene::MeshComponent::MeshSubset& subset = mesh->subsets.emplace_back();
+	subset.materialID = materialEntity;
+	subset.indexOffset = 0;
+	subset.indexCount = (uint32_t)data.indices.size();
+	mesh->CreateRenderData();
+
+	wi::ecs::Entity objectEntity = scene.Entity_CreateObject(name);
+	scene.objects.GetComponent(objectEntity)->meshID = meshEntity;
+	scene.Component_Attach(objectEntity, root);
+
+	return root;
+}
+
+EngineVrRenderModels::Model& EngineVrRenderModels::getModel(const std::string& name)
+{
+	std::unique_ptr<Model>& model = models[name];
+	if (model == nullptr)
+	{
+		model = std::make_unique<Model>();
+		model->name = name;
+		model->data = std::make_shared<Data>();
+		model->state = MODEL_READING_CACHE;
+
+		Model* job = model.get();
+		std::string fileName = getCacheFileName(name);
+		wi::jobsystem::Execute(ctx, [job, fileName](wi::jobsystem::JobArgs args) {
+			job->jobSucceeded.store(readCache(fileName, *job->data));
+			job->jobDone.store(true, std::memory_order_release);
+		});
+	}
+	return *model;
+}
+
+//the name is copied, a view into the frame arena is enough
+void EngineVrRenderModels::setSlotModel(uint32_t slot, std::string_view name)
+{
+	if (slot >= slotCount || slots[slot].name == name)
+		return;
+
+	slots[slot].name = name;
+	if (slots[slot].state != SLOT_BUILDING)
+	{
+		slots[slot].state = name.empty() ? SLOT_IDLE : SLOT_WAITING;
+		if (name.empty() && scene != nullptr && slots[slot].entity != wi::ecs::INVALID_ENTITY)
+		{
+			scene->Entity_Remove(slots[slot].entity, true);
+			slots[slot].entity = wi::ecs::INVALID_ENTITY;
+		}
+	}
+
+	if (!name.empty())
+	{
+		getModel(slots[slot].name);
+	}
+}
+
+wi::ecs::Entity EngineVrRenderModels::getSlotEntity(uint32_t slot) const
+{
+	if (slot >= slotCount)
+		return wi::ecs::INVALID_ENTITY;
+
+	return slots[slot].entity;
+}
+
+void EngineVrRenderModels::update()
+{
+	for (auto& it : models)
+	{
+		updateModel(*it.second);
+	}
+
+	for (Slot& slot : slots)
+	{
+		updateSlot(slot);
+	}
+}
+
+//Runtime loads are polled here, conversion and cache writing run on a worker job
+void EngineVrRenderModels::updateModel(Model& model)
+{
+	switch (model.state)
+	{
+	case MODEL_READING_CACHE:
+		if (model.jobDone.load(std::memory_order_acquire))
+		{
+			if (model.jobSucceeded.load())
+			{
+				stats.cacheHits++;
+				model.state = MODEL_READY;
+			}
+			else if (provider != nullptr)
+			{
+				model.state = MODEL_LOADING_RUNTIME;
+			}
+			else
+			{
+				stats.failures++;
+				model.state = MODEL_FAILED;
+			}
+		}
+		break;
+
+	case MODEL_LOADING_RUNTIME:
+	{
+		vr::EVRRenderModelError error = provider->loadRenderModel(model.name.c_str(), &model.runtimeModel);
+		if (error == vr::VRRenderModelError_None)
+		{
+			model.state = MODEL_LOADING_TEXTURE;
+			if (model.runtimeModel->diffuseTextureId < 0)
+			{
+				startConvert(model);
+			}
+		}
+		else if (error != vr::VRRenderModelError_Loading)
+		{
+			wi::backlog::post("Failed to load render model " + model.name, wi::backlog::LogLevel::Warning);
+			model.runtimeModel = nullptr;
+			stats.failures++;
+			model.state = MODEL_FAILED;
+		}
+	}
+	break;
+
+	case MODEL_LOADING_TEXTURE:
+	{
+		vr::EVRRenderModelError error = provider->loadTexture(model.runtimeModel->diffuseTextureId, &model.runtimeTexture);
+		if (error == vr::VRRenderModelError_Loading)
+			break;
+
+		if (error != vr::VRRenderModelError_None)
+		{
+			//untextured is still better than no model
+			model.runtimeTexture = nullptr;
+		}
+		startConvert(model);
+	}
+	break;
+
+	case MODEL_CONVERTING:
+		if (model.jobDone.load(std::memory_order_acquire))
+		{
+			//runtime memory can only be released once the job stopped reading it
+			provider->freeRenderModel(model.runtimeModel);
+			model.runtimeModel = nullptr;
+			if (model.runtimeTexture != nullptr)
+			{
+				provider->freeTexture(model.runtimeTexture);
+				model.runtimeTexture = nullptr;
+			}
+
+			if (model.jobSucceeded.load())
+			{
+				stats.runtimeLoads++;
+				model.state = MODEL_READY;
+			}
+			else
+			{
+				stats.failures++;
+				model.state = MODEL_FAILED;
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void EngineVrRenderModels::startConvert(Model& model)
+{
+	model.state = MODEL_CONVERTING;
+	model.jobDone.store(false);
+	model.jobSucceeded.store(false);
+
+	Model* job = &model;
+	std::string fileName = getCacheFileName(model.name);
+	wi::jobsystem::Execute(ctx, [job, fileName](wi::jobsystem::JobArgs args) {
+		bool converted = convert(*job->runtimeModel, job->runtimeTexture, *job->data);
+		if (converted)
+		{
+			writeCache(fileName, *job->data);
+		}
+		job->jobSucceeded.store(converted);
+		job->jobDone.store(true, std::memory_order_release);
+	});
+}
+
+void EngineVrRenderModels::updateSlot(Slot& slot)
+{
+	if (slot.state == SLOT_WAITING)
+	{
+		Model& model = getModel(slot.name);
+		if (model.state == MODEL_FAILED)
+		{
+			slot.state = SLOT_IDLE;
+		}
+		else if (model.state == MODEL_READY && scene != nullptr)
+		{
+			slot.buildingName = slot.name;
+			slot.staging = std::make_unique<wi::scene::Scene>();
+			slot.pendingEntity = wi::ecs::INVALID_ENTITY;
+			slot.jobDone.store(false);
+			slot.state = SLOT_BUILDING;
+
+			Slot* job = &slot;
+			std::shared_ptr<Data> data = model.data;
+			wi::jobsystem::Execute(ctx, [job, data](wi::jobsystem::JobArgs args) {
+				job->pendingEntity = buildEntity(job->buildingName, *data, *job->staging);
+				job->jobDone.store(true, std::memory_order_release);
+			});
+		}
+	}
+	else if (slot.state == SLOT_BUILDING && slot.jobDone.load(std::memory_order_acquire))
+	{
+		//the previous model stays visible until this point, so a device change never leaves a hole or a stall
+		scene->Merge(*slot.staging);
+		slot.staging.reset();
+
+		if (slot.entity != wi::ecs::INVALID_ENTITY)
+		{
+			scene->Entity_Remove(slot.entity, true);
+		}
+		slot.entity = slot.pendingEntity;
+		slot.pendingEntity = wi::ecs::INVALID_ENTITY;
+
+		//the slot was given another model while this one was building
+		if (slot.name != slot.buildingName)
+		{
+			slot.state = slot.name.empty() ? SLOT_IDLE : SLOT_WAITING;
+			if (slot.name.empty())
+			{
+				scene->Entity_Remove(slot.entity, true);
+				slot.entity = wi::ecs::INVALID_ENTITY;
+			}
+		}
+		else
+		{
+			slot.state = SLOT_IDLE;
+		}
+	}
+}
+
+void EngineVrRenderModels::clear()
+{
+	wi::jobsystem::Wait(ctx);
+
+	for (auto& it : models)
+	{
+		Model& model = *it.second;
+		if (provider != nullptr && model.runtimeModel != nullptr)
+		{
+			provider->freeRenderModel(model.runtimeModel);
+		}
+		if (provider != nullptr && model.runtimeTexture != nullptr)
+		{
+			provider->freeTexture(model.runtimeTexture);
+		}
+	}
+	models.clear();
+
+	for (Slot& slot : slots)
+	{
+		if (scene != nullptr && slot.entity != wi::ecs::INVALID_ENTITY)
+		{
+			scene->Entity_Remove(slot.entity, true);
+		}
+		slot.name.clear();
+		slot.buildingName.clear();
+		slot.state = SLOT_IDLE;
+		slot.entity = wi::ecs::INVALID_ENTITY;
+		slot.pendingEntity = wi::ecs::INVALID_ENTITY;
+		slot.staging.reset();
+	}
+
+	stats = {};
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <WickedEngine.h>
+
+#include "openvr.h"
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+//The few IVRRenderModels calls the loader needs, so it can be driven by a mock provider
+class EngineVrRenderModelProvider
+{
+public:
+	virtual ~EngineVrRenderModelProvider() = default;
+
+	//both return VRRenderModelError_Loading until the runtime is done, and never block
+	virtual vr::EVRRenderModelError loadRenderModel(const char* name, vr::RenderModel_t** model) = 0;
+	virtual vr::EVRRenderModelError loadTexture(vr::TextureID_t id, vr::RenderModel_TextureMap_t** texture) = 0;
+	virtual void freeRenderModel(vr::RenderModel_t* model) = 0;
+	virtual void freeTexture(vr::RenderModel_TextureMap_t* texture) = 0;
+};
+
+class EngineVrRuntimeRenderModelProvider : public EngineVrRenderModelProvider
+{
+public:
+	EngineVrRuntimeRenderModelProvider(vr::IVRRenderModels* renderModels) : renderModels(renderModels) {}
+
+	vr::EVRRenderModelError loadRenderModel(const char* name, vr::RenderModel_t** model) override;
+	vr::EVRRenderModelError loadTexture(vr::TextureID_t id, vr::RenderModel_TextureMap_t** texture) override;
+	void freeRenderModel(vr::RenderModel_t* model) override;
+	void freeTexture(vr::RenderModel_TextureMap_t* texture) override;
+
+private:
+	vr::IVRRenderModels* renderModels = nullptr;
+};
+
+//Controller models of the connected hardware. Runtime models are converted on worker jobs
+//and cached on disk (one file per render model name), so later sessions skip the runtime entirely.
+//Nothing in update() waits: a slot keeps showing its previous model until the new one is built.
+class EngineVrRenderModels
+{
+public:
+	//converted model, left handed, ready to become a Wicked mesh
+	struct Data
+	{
+		wi::vector<XMFLOAT3> positions;
+		wi::vector<XMFLOAT3> normals;
+		wi::vector<XMFLOAT2> uvs;
+		wi::vector<uint32_t> indices;
+		uint32_t textureWidth = 0;
+		uint32_t textureHeight = 0;
+		//first mip only, kept in the runtime format (block compressed formats are not decoded)
+		vr::EVRRenderModelTextureFormat textureFormat = vr::VRRenderModelTextureFormat_RGBA8_SRGB;
+		wi::vector<uint8_t> texture;
+	};
+
+	struct Stats
+	{
+		uint32_t cacheHits = 0;
+		uint32_t runtimeLoads = 0;
+		uint32_t failures = 0;
+	};
+
+	~EngineVrRenderModels();
+
+	void setProvider(std::shared_ptr<EngineVrRenderModelProvider> value);
+	void setScene(wi::scene::Scene* value);
+	void setCacheDirectory(const std::string& value);
+
+	//which render model a slot (hand) shows
+	void setSlotModel(uint32_t slot, std::string_view name);
+	wi::ecs::Entity getSlotEntity(uint32_t slot) const;
+	void update();
+	//waits for pending jobs and removes every model from the scene
+	void clear();
+
+	const Stats& getStats() const;
+
+	//a texture in a format this code does not know is dropped, the model is kept untextured
+	static bool convert(const vr::RenderModel_t& model, const vr::RenderModel_TextureMap_t* texture, Data& data);
+	//size of the first mip and matching Wicked format, false for an unknown format
+	static bool getTextureLayout(vr::EVRRenderModelTextureFormat format, uint32_t width, uint32_t height, wi::graphics::Format& wickedFormat, uint32_t& rowPitch, size_t& size);
+	static bool writeCache(const std::string& fileName, const Data& data);
+	static bool readCache(const std::string& fileName, Data& data);
+
+	static const uint32_t slotCount = 2;
+
+private:
+	enum MODEL_STATE
+	{
+		MODEL_READING_CACHE,
+		MODEL_LOADING_RUNTIME,
+		MODEL_LOADING_TEXTURE,
+		MODEL_CONVERTING,
+		MODEL_READY,
+		MODEL_FAILED
+	};
+
+	struct Model
+	{
+		std::string name;
+		MODEL_STATE state = MODEL_READING_CACHE;
+		std::shared_ptr<Data> data;
+		vr::RenderModel_t* runtimeModel = nullptr;
+		vr::RenderModel_TextureMap_t* runtimeTexture = nullptr;
+		std::atomic<bool> jobDone{ false };
+		std::atomic<bool> jobSucceeded{ false };
+	};
+
+	enum SLOT_STATE
+	{
+		SLOT_IDLE,
+		SLOT_WAITING,
+		SLOT_BUILDING
+	};
+
+	struct Slot
+	{
+		std::string name;
+		std::string buildingName;
+		SLOT_STATE state = SLOT_IDLE;
+		wi::ecs::Entity entity = wi::ecs::INVALID_ENTITY;
+		wi::ecs::Entity pendingEntity = wi::ecs::INVALID_ENTITY;
+		std::unique_ptr<wi::scene::Scene> staging;
+		std::atomic<bool> jobDone{ false };
+	};
+
+	Model& getModel(const std::string& name);
+	void updateModel(Model& model);
+	void startConvert(Model& model);
+	void updateSlot(Slot& slot);
+	std::string getCacheFileName(const std::string& name) const;
+	static wi::ecs::Entity buildEntity(const std::string& name, const Data& data, wi::scene::Scene& scene);
+
+	std::shared_ptr<EngineVrRenderModelProvider> provider;
+	wi::scene::Scene* scene = nullptr;
+	std::string cacheDirectory = "rendermodels";
+	wi::unordered_map<std::string, std::unique_ptr<Model>> models;
+	Slot slots[slotCount];
+	Stats stats;
+	wi::jobsystem::context ctx;
+};
@@ -0,0 +1,247 @@
+#include "WickedEngine.h"
+#include "EngineVrShadowCache.h"
+#include <algorithm>
+
+static bool isCaster(const wi::scene::Scene& scene, wi::ecs::Entity entity)
+{
+	const wi::scene::ObjectComponent* object = scene.objects.GetComponent(entity);
+	return object != nullptr && object->IsCastingShadow();
+}
+
+static bool isSameBox(const wi::primitive::AABB& a, const wi::primitive::AABB& b)
+{
+	return a._min.x == b._min.x && a._min.y == b._min.y && a._min.z == b._min.z &&
+		a._max.x == b._max.x && a._max.y == b._max.y && a._max.z == b._max.z;
+}
+
+static bool isSameLight(const EngineVrShadowCache::LightState& a, const EngineVrShadowCache::LightState& b)
+{
+	return a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z &&
+		a.rotation.x == b.rotation.x && a.rotation.y == b.rotation.y && a.rotation.z == b.rotation.z && a.rotation.w == b.rotation.w &&
+		a.range == b.range && a.outerConeAngle == b.outerConeAngle && a.directional == b.directional;
+}
+
+uint32_t EngineVrShadowCache::buildInvalidationSet(const wi::scene::Scene& scene, const SceneState& previous, SceneState& current, wi::vector<wi::ecs::Entity>& dirtyLights)
+{
+	current.lights.clear();
+	current.casters.clear();
+	current.movedBounds.clear();
+
+	//both lists are in component order, so a single walk matches them
+	size_t last = 0;
+	for (size_t i = 0; i < scene.objects.GetCount(); ++i)
+	{
+		const wi::scene::ObjectComponent& object = scene.objects[i];
+		if (!object.IsCastingShadow())
+			continue;
+
+		CasterState caster;
+		caster.entity = scene.objects.GetEntity(i);
+		caster.aabb = scene.aabb_objects[i];
+		const wi::scene::MeshComponent* mesh = scene.meshes.GetComponent(object.meshID);
+		caster.skinned = mesh != nullptr && mesh->IsSkinned();
+		current.casters.push_back(caster);
+
+		//removed casters leave their old place to be redrawn
+		while (last < previous.casters.size() && previous.casters[last].entity != caster.entity && !isCaster(scene, previous.casters[last].entity))
+		{
+			current.movedBounds.push_back(previous.casters[last].aabb);
+			last++;
+		}
+
+		if (last < previous.casters.size() && previous.casters[last].entity == caster.entity)
+		{
+			const CasterState& before = previous.casters[last];
+			if (caster.skinned || !isSameBox(before.aabb, caster.aabb))
+			{
+				current.movedBounds.push_back(wi::primitive::AABB::Merge(before.aabb, caster.aabb));
+			}
+			last++;
+		}
+		else
+		{
+			//added, or moved in the component list by a removal
+			current.movedBounds.push_back(caster.aabb);
+		}
+	}
+
+	for (; last < previous.casters.size(); ++last)
+	{
+		current.movedBounds.push_back(previous.casters[last].aabb);
+	}
+
+	for (size_t i = 0; i < scene.lights.GetCount(); ++i)
+	{
+		const wi::scene::LightComponent& light = scene.lights[i];
+		if (!light.IsCastingShadow())
+			continue;
+
+		LightState state;
+		state.entity = scene.lights.GetEntity(i);
+		state.position = light.position;
+		state.rotation = light.rotation;
+		state.range = light.GetRange();
+		state.outerConeAngle = light.outerConeAngle;
+		state.directional = light.GetType() == wi::scene::LightComponent::DIRECTIONAL;
+		current.lights.push_back(state);
+
+		const LightState* before = nullptr;
+		for (const LightState& candidate : previous.lights)
+		{
+			if (candidate.entity == state.entity)
+			{
+				before = &candidate;
+				break;
+			}
+		}
+
+		bool dirty = state.directional || before == nullptr || !isSameLight(*before, state);
+		for (size_t m = 0; m < current.movedBounds.size() && !dirty; ++m)
+		{
+			dirty = scene.aabb_lights[i].intersects(current.movedBounds[m]) != wi::primitive::AABB::OUTSIDE;
+		}
+
+		if (dirty)
+		{
+			dirtyLights.push_back(state.entity);
+		}
+	}
+
+	return (uint32_t)current.movedBounds.size();
+}
+
+void EngineVrShadowCache::setEnabled(bool value)
+{
+	enabled = value;
+	invalidate();
+}
+
+bool EngineVrShadowCache::isEnabled() const
+{
+	return enabled;
+}
+
+void EngineVrShadowCache::invalidate()
+{
+	atlasValid = false;
+	atlas.clear();
+}
+
+void EngineVrShadowCache::beginFrame()
+{
+	frameUpdated = false;
+	stats.cachedMaps = 0;
+	stats.renderedMaps = 0;
+	stats.directionalMisses = 0;
+	stats.atlasMisses = 0;
+	stats.dirtyLightMisses = 0;
+}
+
+void EngineVrShadowCache::prepare(wi::RenderPath3D& path)
+{
+	if (!enabled || path.scene == nullptr)
+	{
+		path.setShadowsEnabled(true);
+		return;
+	}
+
+	const wi::scene::Scene& scene = *path.scene;
+
+	//the first render path of the frame runs after the scene update, the invalidation set is built there
+	if (!frameUpdated)
+	{
+		frameUpdated = true;
+		const SceneState& previous = states[currentState];
+		currentState ^= 1;
+		dirtyLights.clear();
+		stats.movingCasters = buildInvalidationSet(scene, previous, states[currentState], dirtyLights);
+		stats.dirtyLights = (uint32_t)dirtyLights.size();
+	}
+
+	pathAtlas.clear();
+	bool directional = false;
+	for (uint32_t lightIndex : path.visibility_main.visibleLights)
+	{
+		const wi::scene::LightComponent& light = scene.lights[lightIndex];
+		if (!light.IsCastingShadow())
+			continue;
+
+		AtlasEntry entry;
+		entry.entity = scene.lights.GetEntity(lightIndex);
+		entry.x = light.shadow_rect.x;
+		entry.y = light.shadow_rect.y;
+		entry.width = light.shadow_rect.w;
+		entry.height = light.shadow_rect.h;
+		pathAtlas.push_back(entry);
+		directional = directional || light.GetType() == wi::scene::LightComponent::DIRECTIONAL;
+	}
+
+	bool reuse = false;
+	if (directional)
+	{
+		stats.directionalMisses++;
+	}
+	else if (!atlasValid || !isSameAtlas())
+	{
+		stats.atlasMisses++;
+	}
+	else
+	{
+		reuse = true;
+		for (size_t i = 0; i < pathAtlas.size() && reuse; ++i)
+		{
+			reuse = !isDirty(pathAtlas[i].entity);
+		}
+		if (!reuse)
+		{
+			stats.dirtyLightMisses++;
+		}
+	}
+
+	path.setShadowsEnabled(!reuse);
+
+	if (reuse)
+	{
+		stats.cachedMaps += (uint32_t)pathAtlas.size();
+		return;
+	}
+
+	stats.renderedMaps += (uint32_t)pathAtlas.size();
+	atlas = pathAtlas;
+	atlasValid = true;
+
+	//drawn with their current state, only directional lights stay dirty for the next render path
+	for (const AtlasEntry& entry : pathAtlas)
+	{
+		const wi::scene::LightComponent* light = scene.lights.GetComponent(entry.entity);
+		if (light != nullptr && light->GetType() != wi::scene::LightComponent::DIRECTIONAL)
+		{
+			dirtyLights.erase(std::remove(dirtyLights.begin(), dirtyLights.end(), entry.entity), dirtyLights.end());
+		}
+	}
+}
+
+const EngineVrShadowCache::Stats& EngineVrShadowCache::getStats() const
+{
+	return stats;
+}
+
+bool EngineVrShadowCache::isDirty(wi::ecs::Entity entity) const
+{
+	return std::find(dirtyLights.begin(), dirtyLights.end(), entity) != dirtyLights.end();
+}
+
+bool EngineVrShadowCache::isSameAtlas() const
+{
+	if (atlas.size() != pathAtlas.size())
+		return false;
+
+	for (size_t i = 0; i < atlas.size(); ++i)
+	{
+		if (atlas[i].entity != pathAtlas[i].entity || atlas[i].x != pathAtlas[i].x || atlas[i].y != pathAtlas[i].y ||
+			atlas[i].width != pathAtlas[i].width || atlas[i].height != pathAtlas[i].height)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <WickedEngine.h>
+
+//Keeps the shadow maps of the VR render paths across eyes and frames.
+//Wicked draws all the shadow maps of a render path into one shared atlas, so the atlas is what gets cached:
+//a render path skips its shadow pass when it would draw the same lights into the same atlas rects,
+//and none of those lights moved or was reached by a moving caster since they were last drawn.
+class EngineVrShadowCache
+{
+public:
+	struct Stats
+	{
+		uint32_t cachedMaps = 0;
+		uint32_t renderedMaps = 0;
+		uint32_t dirtyLights = 0;
+		uint32_t movingCasters = 0;
+		//render paths that drew their shadow pass again, by the first reason found :
+		//a visible directional light (its cascades follow the camera, so the atlas is never reused with one),
+		//an atlas holding other lights or rects than the last drawn one, or a light of the atlas being dirty
+		uint32_t directionalMisses = 0;
+		uint32_t atlasMisses = 0;
+		uint32_t dirtyLightMisses = 0;
+	};
+
+	struct LightState
+	{
+		wi::ecs::Entity entity = wi::ecs::INVALID_ENTITY;
+		XMFLOAT3 position = XMFLOAT3(0, 0, 0);
+		XMFLOAT4 rotation = XMFLOAT4(0, 0, 0, 1);
+		float range = 0.0f;
+		float outerConeAngle = 0.0f;
+		bool directional = false;
+	};
+
+	struct CasterState
+	{
+		wi::ecs::Entity entity = wi::ecs::INVALID_ENTITY;
+		wi::primitive::AABB aabb;
+		bool skinned = false;
+	};
+
+	//Shadow casting lights and objects of one frame, in component order
+	struct SceneState
+	{
+		wi::vector<LightState> lights;
+		wi::vector<CasterState> casters;
+		//where the casters that moved, appeared or disappeared since the previous state were and are
+		wi::vector<wi::primitive::AABB> movedBounds;
+	};
+
+	//Compares the scene to the previous state, fills current and appends the lights whose maps are out of date.
+	//Skinned casters always count as moving, directional lights are always dirty (their cascades follow the camera).
+	//Returns the number of moving casters.
+	static uint32_t buildInvalidationSet(const wi::scene::Scene& scene, const SceneState& previous, SceneState& current, wi::vector<wi::ecs::Entity>& dirtyLights);
+
+	void setEnabled(bool value);
+	bool isEnabled() const;
+	//the atlas content is unknown once something else drew shadows into it
+	void invalidate();
+	//once per frame, before the first render path
+	void beginFrame();
+	//after the Update of a render path (culling and atlas packing) and before its Render
+	void prepare(wi::RenderPath3D& path);
+	const Stats& getStats() const;
+
+private:
+	struct AtlasEntry
+	{
+		wi::ecs::Entity entity = wi::ecs::INVALID_ENTITY;
+		int x = 0;
+		int y = 0;
+		int width = 0;
+		int height = 0;
+	};
+
+	bool isDirty(wi::ecs::Entity entity) const;
+	bool isSameAtlas() const;
+
+	bool enabled = false;
+	bool frameUpdated = false;
+	bool atlasValid = false;
+	Stats stats;
+	SceneState states[2];
+	uint32_t currentState = 0;
+	wi::vector<wi::ecs::Entity> dirtyLights;
+	wi::vector<AtlasEntry> atlas;
+	wi::vector<AtlasEntry> pathAtlas;
+};
@@ -0,0 +1,359 @@
+#include "WickedEngine.h"
+#include "EngineVrStreaming.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+//Distance from p to the segment a-b, in the XY plane
+static float segmentDistance(XMVECTOR a, XMVECTOR b, XMVECTOR p)
+{
+	XMVECTOR ab = XMVectorSubtract(b, a);
+	float lengthSq = XMVectorGetX(XMVector2LengthSq(ab));
+	float t = 0.0f;
+	if (lengthSq > 0.0f)
+	{
+		t = std::clamp(XMVectorGetX(XMVector2Dot(XMVectorSubtract(p, a), ab)) / lengthSq, 0.0f, 1.0f);
+	}
+	return XMVectorGetX(XMVector2Length(XMVectorSubtract(p, XMVectorMultiplyAdd(ab, XMVectorReplicate(t), a))));
+}
+
+EngineVrSceneChunkLoader::EngineVrSceneChunkLoader(wi::scene::Scene* scene, const std::string& directory) : scene(scene), directory(directory) {}
+
+std::string EngineVrSceneChunkLoader::getChunkFileName(int x, int z)
+{
+	return directory + "/" + std::to_string(x) + "_" + std::to_string(z) + ".wiscene";
+}
+
+void EngineVrSceneChunkLoader::getManifest(wi::vector<ChunkInfo>& manifest)
+{
+	manifest.clear();
+
+	std::ifstream file(directory + "/manifest.txt");
+	if (file.is_open())
+	{
+		ChunkInfo info;
+		while (file >> info.x >> info.z >> info.cost)
+		{
+			manifest.push_back(info);
+		}
+		return;
+	}
+
+	//no manifest, one pass over the directory
+	std::error_code error;
+	for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+	{
+		if (it->path().extension() != ".wiscene")
+			continue;
+
+		ChunkInfo info;
+		uintmax_t size = it->file_size(error);
+		if (error || sscanf(it->path().stem().string().c_str(), "%d_%d", &info.x, &info.z) != 2)
+		{
+			error.clear();
+			continue;
+		}
+		info.cost = (uint64_t)size;
+		manifest.push_back(info);
+	}
+}
+
+bool EngineVrSceneChunkLoader::loadChunk(int x, int z, wi::scene::Scene& chunkScene, wi::ecs::Entity& root)
+{
+	//chunks are authored in world space, everything is attached to one root so the chunk can be removed at once
+	root = wi::scene::LoadModel(chunkScene, getChunkFileName(x, z), XMMatrixIdentity(), true);
+	return root != wi::ecs::INVALID_ENTITY;
+}
+
+void EngineVrSceneChunkLoader::attachChunk(wi::scene::Scene& chunkScene)
+{
+	if (scene != nullptr)
+	{
+		scene->Merge(chunkScene);
+	}
+}
+
+void EngineVrSceneChunkLoader::evictChunk(wi::ecs::Entity root)
+{
+	if (scene != nullptr && root != wi::ecs::INVALID_ENTITY)
+	{
+		scene->Entity_Remove(root, true);
+	}
+}
+
+EngineVrStreaming::~EngineVrStreaming()
+{
+	clear();
+}
+
+void EngineVrStreaming::setLoader(std::shared_ptr<EngineVrChunkLoader> value)
+{
+	clear();
+	chunks.clear();
+	loader = value;
+
+	if (loader == nullptr)
+		return;
+
+	wi::vector<EngineVrChunkLoader::ChunkInfo> manifest;
+	loader->getManifest(manifest);
+	for (const EngineVrChunkLoader::ChunkInfo& info : manifest)
+	{
+		if (info.cost == 0)
+			continue;
+
+		std::unique_ptr<Chunk>& chunk = chunks[chunkKey(info.x, info.z)];
+		chunk = std::make_unique<Chunk>();
+		chunk->x = info.x;
+		chunk->z = info.z;
+		chunk->cost = info.cost;
+	}
+}
+
+void EngineVrStreaming::setSettings(const Settings& value)
+{
+	settings = value;
+	settings.chunkSize = std::max(settings.chunkSize, 1.0f);
+	settings.maxConcurrentLoads = std::max(settings.maxConcurrentLoads, 1u);
+}
+
+const EngineVrStreaming::Settings& EngineVrStreaming::getSettings() const
+{
+	return settings;
+}
+
+bool EngineVrStreaming::isEnabled() const
+{
+	return loader != nullptr;
+}
+
+const EngineVrStreaming::Stats& EngineVrStreaming::getStats() const
+{
+	return stats;
+}
+
+bool EngineVrStreaming::isChunkResident(int x, int z) const
+{
+	auto it = chunks.find(chunkKey(x, z));
+	return it != chunks.end() && it->second->state == CHUNK_RESIDENT;
+}
+
+uint64_t EngineVrStreaming::chunkKey(int x, int z)
+{
+	return ((uint64_t)(uint32_t)x << 32ull) | (uint64_t)(uint32_t)z;
+}
+
+EngineVrStreaming::Chunk* EngineVrStreaming::findChunk(int x, int z)
+{
+	auto it = chunks.find(chunkKey(x, z));
+	return it != chunks.end() ? it->second.get() : nullptr;
+}
+
+void EngineVrStreaming::update(const XMFLOAT3& position, const XMFLOAT3& velocity, float dt)
+{
+	if (!isEnabled())
+		return;
+
+	finishLoads();
+
+	//the range is a capsule from the current position to the predicted one
+	XMVECTOR from = XMVectorSet(position.x, position.z, 0.0f, 0.0f);
+	XMVECTOR to = XMVectorAdd(from, XMVectorScale(XMVectorSet(velocity.x, velocity.z, 0.0f, 0.0f), settings.predictionTime));
+
+	float minX = std::min(XMVectorGetX(from), XMVectorGetX(to)) - settings.loadRadius;
+	float maxX = std::max(XMVectorGetX(from), XMVectorGetX(to)) + settings.loadRadius;
+	float minZ = std::min(XMVectorGetY(from), XMVectorGetY(to)) - settings.loadRadius;
+	float maxZ = std::max(XMVectorGetY(from), XMVectorGetY(to)) + settings.loadRadius;
+
+	for (auto& it : chunks)
+	{
+		it.second->inRange = false;
+	}
+
+	candidates.clear();
+
+	for (int x = (int)std::floor(minX / settings.chunkSize); x <= (int)std::floor(maxX / settings.chunkSize); ++x)
+	{
+		for (int z = (int)std::floor(minZ / settings.chunkSize); z <= (int)std::floor(maxZ / settings.chunkSize); ++z)
+		{
+			XMVECTOR center = XMVectorSet((x + 0.5f) * settings.chunkSize, (z + 0.5f) * settings.chunkSize, 0.0f, 0.0f);
+			float distancePath = segmentDistance(from, to, center);
+
+			if (distancePath > settings.loadRadius)
+				continue;
+
+			Chunk* chunk = findChunk(x, z);
+			if (chunk == nullptr || chunk->state == CHUNK_EMPTY)
+				continue;
+
+			chunk->inRange = true;
+			chunk->outOfRangeTime = 0.0f;
+
+			if (chunk->state == CHUNK_UNLOADED)
+			{
+				Candidate candidate;
+				candidate.chunk = chunk;
+				candidate.distance = XMVectorGetX(XMVector2Length(XMVectorSubtract(center, from)));
+				candidates.push_back(candidate);
+			}
+		}
+	}
+
+	for (auto& it : chunks)
+	{
+		Chunk& chunk = *it.second;
+		if (chunk.state == CHUNK_RESIDENT && !chunk.inRange)
+		{
+			chunk.outOfRangeTime += dt;
+			if (chunk.outOfRangeTime >= settings.evictDelay)
+			{
+				evict(chunk);
+			}
+		}
+	}
+
+	//closest chunks first
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+		return a.distance < b.distance;
+	});
+
+	for (const Candidate& candidate : candidates)
+	{
+		if (stats.loadingChunks >= settings.maxConcurrentLoads)
+			break;
+
+		Chunk* chunk = candidate.chunk;
+		if (!makeRoom(chunk->cost))
+		{
+			stats.budgetStalls++;
+			break;
+		}
+
+		chunk->state = CHUNK_LOADING;
+		chunk->ready.store(false);
+		chunk->failed.store(false);
+		chunk->root = wi::ecs::INVALID_ENTITY;
+		chunk->staging = std::make_unique<wi::scene::Scene>();
+		loadingBytes += chunk->cost;
+		stats.loadingChunks++;
+		stats.loadsStarted++;
+
+		EngineVrChunkLoader* chunkLoader = loader.get();
+		wi::jobsystem::Execute(ctx, [chunkLoader, chunk](wi::jobsystem::JobArgs args) {
+			if (!chunkLoader->loadChunk(chunk->x, chunk->z, *chunk->staging, chunk->root))
+			{
+				chunk->failed.store(true);
+			}
+			chunk->ready.store(true, std::memory_order_release);
+		});
+	}
+}
+
+//Attach chunks whose job is done, on the frame thread so the scene is never touched by a worker
+void EngineVrStreaming::finishLoads()
+{
+	if (stats.loadingChunks == 0)
+		return;
+
+	for (auto& it : chunks)
+	{
+		Chunk& chunk = *it.second;
+		if (chunk.state != CHUNK_LOADING || !chunk.ready.load(std::memory_order_acquire))
+			continue;
+
+		loadingBytes -= chunk.cost;
+		stats.loadingChunks--;
+
+		if (chunk.failed.load())
+		{
+			wi::backlog::post("Failed to stream chunk " + std::to_string(chunk.x) + "_" + std::to_string(chunk.z), wi::backlog::LogLevel::Warning);
+			chunk.state = CHUNK_EMPTY;
+		}
+		else
+		{
+			loader->attachChunk(*chunk.staging);
+			chunk.state = CHUNK_RESIDENT;
+			stats.residentBytes += chunk.cost;
+			stats.residentChunks++;
+		}
+
+		chunk.staging.reset();
+	}
+}
+
+void EngineVrStreaming::evict(Chunk& chunk)
+{
+	loader->evictChunk(chunk.root);
+	chunk.root = wi::ecs::INVALID_ENTITY;
+	chunk.state = CHUNK_UNLOADED;
+	chunk.outOfRangeTime = 0.0f;
+	stats.residentBytes -= chunk.cost;
+	stats.residentChunks--;
+	stats.evictions++;
+}
+
+//Evict out of range chunks, longest out of range first, until the cost fits in the budget
+bool EngineVrStreaming::makeRoom(uint64_t cost)
+{
+	while (stats.residentBytes + loadingBytes + cost > settings.memoryBudget)
+	{
+		Chunk* victim = nullptr;
+		for (auto& it : chunks)
+		{
+			Chunk& chunk = *it.second;
+			if (chunk.state == CHUNK_RESIDENT && !chunk.inRange && (victim == nullptr || chunk.outOfRangeTime > victim->outOfRangeTime))
+			{
+				victim = &chunk;
+			}
+		}
+
+		if (victim == nullptr)
+			return false;
+
+		evict(*victim);
+	}
+
+	return true;
+}
+
+void EngineVrStreaming::waitForLoads()
+{
+	wi::jobsystem::Wait(ctx);
+
+	if (loader != nullptr)
+	{
+		finishLoads();
+	}
+}
+
+void EngineVrStreaming::clear()
+{
+	waitForLoads();
+
+	if (loader != nullptr)
+	{
+		for (auto& it : chunks)
+		{
+			if (it.second->state == CHUNK_RESIDENT)
+			{
+				evict(*it.second);
+			}
+		}
+	}
+
+	//back to the manifest state, failed chunks are tried again next time
+	for (auto& it : chunks)
+	{
+		Chunk& chunk = *it.second;
+		chunk.state = CHUNK_UNLOADED;
+		chunk.outOfRangeTime = 0.0f;
+		chunk.inRange = false;
+		chunk.root = wi::ecs::INVALID_ENTITY;
+		chunk.staging.reset();
+	}
+
+	candidates.clear();
+	loadingBytes = 0;
+	stats = {};
+}
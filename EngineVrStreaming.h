@@ -0,0 +1,139 @@
+#pragma once
+#include <WickedEngine.h>
+
+#include <atomic>
+#include <memory>
+
+//Loading backend for the streaming grid. The default one loads .wiscene files,
+//a synthetic one can be used to drive the prefetch logic from scripted pose tracks.
+class EngineVrChunkLoader
+{
+public:
+	struct ChunkInfo
+	{
+		int x = 0;
+		int z = 0;
+		//size in bytes
+		uint64_t cost = 0;
+	};
+
+	virtual ~EngineVrChunkLoader() = default;
+
+	//every chunk of the grid, called once when the loader is set (cells that are not listed stay empty)
+	virtual void getManifest(wi::vector<ChunkInfo>& manifest) = 0;
+	//called from a worker job, loads the chunk into its own scene
+	virtual bool loadChunk(int x, int z, wi::scene::Scene& chunkScene, wi::ecs::Entity& root) = 0;
+	//called from the frame thread
+	virtual void attachChunk(wi::scene::Scene& chunkScene) = 0;
+	virtual void evictChunk(wi::ecs::Entity root) = 0;
+};
+
+//Loads <directory>/<x>_<z>.wiscene into the target scene.
+//The chunks are listed in <directory>/manifest.txt (one "x z bytes" line per chunk),
+//without a manifest the directory is scanned once instead.
+class EngineVrSceneChunkLoader : public EngineVrChunkLoader
+{
+public:
+	EngineVrSceneChunkLoader(wi::scene::Scene* scene, const std::string& directory);
+
+	void getManifest(wi::vector<ChunkInfo>& manifest) override;
+	bool loadChunk(int x, int z, wi::scene::Scene& chunkScene, wi::ecs::Entity& root) override;
+	void attachChunk(wi::scene::Scene& chunkScene) override;
+	void evictChunk(wi::ecs::Entity root) override;
+
+private:
+	std::string getChunkFileName(int x, int z);
+
+	wi::scene::Scene* scene = nullptr;
+	std::string directory;
+};
+
+//Streams chunks of a regular grid (XZ plane) around the predicted HMD position
+class EngineVrStreaming
+{
+public:
+	struct Settings
+	{
+		float chunkSize = 32.0f;
+		//chunks closer than this to the path between the current and predicted position are prefetched
+		float loadRadius = 64.0f;
+		//seconds of velocity added to the current position
+		float predictionTime = 1.0f;
+		//seconds a chunk must be out of range before it is evicted
+		float evictDelay = 5.0f;
+		uint64_t memoryBudget = 512ull * 1024ull * 1024ull;
+		uint32_t maxConcurrentLoads = 2;
+	};
+
+	struct Stats
+	{
+		uint32_t residentChunks = 0;
+		uint32_t loadingChunks = 0;
+		uint64_t residentBytes = 0;
+		uint32_t loadsStarted = 0;
+		uint32_t evictions = 0;
+		uint32_t budgetStalls = 0;
+	};
+
+	~EngineVrStreaming();
+
+	//reads the chunk manifest of the loader, the frame thread never asks the loader for sizes
+	void setLoader(std::shared_ptr<EngineVrChunkLoader> value);
+	void setSettings(const Settings& value);
+	const Settings& getSettings() const;
+	bool isEnabled() const;
+
+	//position and velocity in world space
+	void update(const XMFLOAT3& position, const XMFLOAT3& velocity, float dt);
+	//waits for pending loads and attaches them (loading screens, tests), update() never waits
+	void waitForLoads();
+	//waits for pending loads and evicts every resident chunk, the manifest is kept
+	void clear();
+
+	const Stats& getStats() const;
+	bool isChunkResident(int x, int z) const;
+
+private:
+	enum CHUNK_STATE
+	{
+		CHUNK_EMPTY,
+		CHUNK_UNLOADED,
+		CHUNK_LOADING,
+		CHUNK_RESIDENT
+	};
+
+	struct Chunk
+	{
+		int x = 0;
+		int z = 0;
+		CHUNK_STATE state = CHUNK_UNLOADED;
+		uint64_t cost = 0;
+		float outOfRangeTime = 0.0f;
+		bool inRange = false;
+		wi::ecs::Entity root = wi::ecs::INVALID_ENTITY;
+		std::unique_ptr<wi::scene::Scene> staging;
+		std::atomic<bool> ready{ false };
+		std::atomic<bool> failed{ false };
+	};
+
+	struct Candidate
+	{
+		Chunk* chunk = nullptr;
+		float distance = 0.0f;
+	};
+
+	static uint64_t chunkKey(int x, int z);
+	//nullptr when the manifest has no chunk in this cell
+	Chunk* findChunk(int x, int z);
+	void finishLoads();
+	void evict(Chunk& chunk);
+	bool makeRoom(uint64_t cost);
+
+	Settings settings;
+	Stats stats;
+	std::shared_ptr<EngineVrChunkLoader> loader;
+	wi::unordered_map<uint64_t, std::unique_ptr<Chunk>> chunks;
+	wi::vector<Candidate> candidates;
+	wi::jobsystem::context ctx;
+	uint64_t loadingBytes = 0;
+};
@@ -0,0 +1,327 @@
+#include "WickedEngine.h"
+#include "EngineVrInput.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+//EngineVrInput against a mock vr::IVRInput: one runtime update per frame,
+//and the actions written as the legacy button ids getControllerActions reads (trigger 33, grip 2, A/X 7, B/Y 1).
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+//Handles are given in request order, action data is set by path and counted per call
+class MockInput : public vr::IVRInput
+{
+public:
+	struct Action
+	{
+		std::string path;
+		bool active = true;
+		bool pressed = false;
+		XMFLOAT2 axis = XMFLOAT2(0, 0);
+		bool poseValid = false;
+		vr::HmdMatrix34_t pose = {};
+	};
+
+	Action* find(const char* path)
+	{
+		for (Action& action : actions)
+		{
+			if (action.path == path)
+				return &action;
+		}
+		return nullptr;
+	}
+
+	Action& get(const char* path)
+	{
+		Action* action = find(path);
+		if (action == nullptr)
+		{
+			actions.push_back(Action());
+			actions.back().path = path;
+			action = &actions.back();
+		}
+		return *action;
+	}
+
+	vr::EVRInputError SetActionManifestPath(const char* pchActionManifestPath) override
+	{
+		manifestPath = pchActionManifestPath;
+		return vr::VRInputError_None;
+	}
+
+	vr::EVRInputError GetActionSetHandle(const char* pchActionSetName, vr::VRActionSetHandle_t* pHandle) override
+	{
+		*pHandle = getHandle(pchActionSetName);
+		return vr::VRInputError_None;
+	}
+
+	vr::EVRInputError GetActionHandle(const char* pchActionName, vr::VRActionHandle_t* pHandle) override
+	{
+		if (missingAction == pchActionName)
+			return vr::VRInputError_NameNotFound;
+
+		*pHandle = getHandle(pchActionName);
+		return vr::VRInputError_None;
+	}
+
+	vr::EVRInputError UpdateActionState(vr::VRActiveActionSet_t* pSets, uint32_t unSizeOfVRSelectedActionSet_t, uint32_t unSetCount) override
+	{
+		updateCalls++;
+		lastSetCount = unSetCount;
+		if (failUpdate)
+			return vr::VRInputError_InvalidParam;
+
+		//the runtime state only changes here, like the real one
+		updatedActions = actions;
+		return vr::VRInputError_None;
+	}
+
+	vr::EVRInputError GetDigitalActionData(vr::VRActionHandle_t action, vr::InputDigitalActionData_t* pActionData, uint32_t unActionDataSize, vr::VRInputValueHandle_t ulRestrictToDevice) override
+	{
+		const Action* state = getUpdated(action);
+		if (state == nullptr || unActionDataSize != sizeof(vr::InputDigitalActionData_t))
+			return vr::VRInputError_InvalidHandle;
+
+		*pActionData = {};
+		pActionData->bActive = state->active;
+		pActionData->bState = state->pressed;
+		return vr::VRInputError_None;
+	}
+
+	vr::EVRInputError GetAnalogActionData(vr::VRActionHandle_t action, vr::InputAnalogActionData_t* pActionData, uint32_t unActionDataSize, vr::VRInputValueHandle_t ulRestrictToDevice) override
+	{
+		const Action* state = getUpdated(action);
+		if (state == nullptr || unActionDataSize != sizeof(vr::InputAnalogActionData_t))
+			return vr::VRInputError_InvalidHandle;
+
+		*pActionData = {};
+		pActionData->bActive = state->active;
+		pActionData->x = state->axis.x;
+		pActionData->y = state->axis.y;
+		return vr::VRInputError_None;
+	}
+
+	vr::EVRInputError GetPoseActionDataForNextFrame(vr::VRActionHandle_t action, vr::ETrackingUniverseOrigin eOrigin, vr::InputPoseActionData_t* pActionData, uint32_t unActionDataSize, vr::VRInputValueHandle_t ulRestrictToDevice) override
+	{
+		const Action* state = getUpdated(action);
+		if (state == nullptr || unActionDataSize != sizeof(vr::InputPoseActionData_t))
+			return vr::VRInputError_InvalidHandle;
+
+		*pActionData = {};
+		pActionData->bActive = state->active;
+		pActionData->pose.bPoseIsValid = state->poseValid;
+		pActionData->pose.mDeviceToAbsoluteTracking = state->pose;
+		return vr::VRInputError_None;
+	}
+
+	//not used by EngineVrInput
+	vr::EVRInputError GetInputSourceHandle(const char* pchInputSourcePath, vr::VRInputValueHandle_t* pHandle) override { return unused(); }
+	vr::EVRInputError GetPoseActionDataRelativeToNow(vr::VRActionHandle_t action, vr::ETrackingUniverseOrigin eOrigin, float fPredictedSecondsFromNow, vr::InputPoseActionData_t* pActionData, uint32_t unActionDataSize, vr::VRInputValueHandle_t ulRestrictToDevice) override { return unused(); }
+	vr::EVRInputError GetSkeletalActionData(vr::VRActionHandle_t action, vr::InputSkeletalActionData_t* pActionData, uint32_t unActionDataSize) override { return unused(); }
+	vr::EVRInputError GetDominantHand(vr::ETrackedControllerRole* peDominantHand) override { return unused(); }
+	vr::EVRInputError SetDominantHand(vr::ETrackedControllerRole eDominantHand) override { return unused(); }
+	vr::EVRInputError GetBoneCount(vr::VRActionHandle_t action, uint32_t* pBoneCount) override { return unused(); }
+	vr::EVRInputError GetBoneHierarchy(vr::VRActionHandle_t action, vr::BoneIndex_t* pParentIndices, uint32_t unIndexArayCount) override { return unused(); }
+	vr::EVRInputError GetBoneName(vr::VRActionHandle_t action, vr::BoneIndex_t nBoneIndex, char* pchBoneName, uint32_t unNameBufferSize) override { return unused(); }
+	vr::EVRInputError GetSkeletalReferenceTransforms(vr::VRActionHandle_t action, vr::EVRSkeletalTransformSpace eTransformSpace, vr::EVRSkeletalReferencePose eReferencePose, vr::VRBoneTransform_t* pTransformArray, uint32_t unTransformArrayCount) override { return unused(); }
+	vr::EVRInputError GetSkeletalTrackingLevel(vr::VRActionHandle_t action, vr::EVRSkeletalTrackingLevel* pSkeletalTrackingLevel) override { return unused(); }
+	vr::EVRInputError GetSkeletalBoneData(vr::VRActionHandle_t action, vr::EVRSkeletalTransformSpace eTransformSpace, vr::EVRSkeletalMotionRange eMotionRange, vr::VRBoneTransform_t* pTransformArray, uint32_t unTransformArrayCount) override { return unused(); }
+	vr::EVRInputError GetSkeletalSummaryData(vr::VRActionHandle_t action, vr::EVRSummaryType eSummaryType, vr::VRSkeletalSummaryData_t* pSkeletalSummaryData) override { return unused(); }
+	vr::EVRInputError GetSkeletalBoneDataCompressed(vr::VRActionHandle_t action, vr::EVRSkeletalMotionRange eMotionRange, void* pvCompressedData, uint32_t unCompressedSize, uint32_t* punRequiredCompressedSize) override { return unused(); }
+	vr::EVRInputError DecompressSkeletalBoneData(const void* pvCompressedBuffer, uint32_t unCompressedBufferSize, vr::EVRSkeletalTransformSpace eTransformSpace, vr::VRBoneTransform_t* pTransformArray, uint32_t unTransformArrayCount) override { return unused(); }
+	vr::EVRInputError TriggerHapticVibrationAction(vr::VRActionHandle_t action, float fStartSecondsFromNow, float fDurationSeconds, float fFrequency, float fAmplitude, vr::VRInputValueHandle_t ulRestrictToDevice) override { return unused(); }
+	vr::EVRInputError GetActionOrigins(vr::VRActionSetHandle_t actionSetHandle, vr::VRActionHandle_t digitalActionHandle, vr::VRInputValueHandle_t* originsOut, uint32_t originOutCount) override { return unused(); }
+	vr::EVRInputError GetOriginLocalizedName(vr::VRInputValueHandle_t origin, char* pchNameArray, uint32_t unNameArraySize, int32_t unStringSectionsToInclude) override { return unused(); }
+	vr::EVRInputError GetOriginTrackedDeviceInfo(vr::VRInputValueHandle_t origin, vr::InputOriginInfo_t* pOriginInfo, uint32_t unOriginInfoSize) override { return unused(); }
+	vr::EVRInputError GetActionBindingInfo(vr::VRActionHandle_t action, vr::InputBindingInfo_t* pOriginInfo, uint32_t unBindingInfoSize, uint32_t unBindingInfoCount, uint32_t* punReturnedBindingInfoCount) override { return unused(); }
+	vr::EVRInputError ShowActionOrigins(vr::VRActionSetHandle_t actionSetHandle, vr::VRActionHandle_t ulActionHandle) override { return unused(); }
+	vr::EVRInputError ShowBindingsForActionSet(vr::VRActiveActionSet_t* pSets, uint32_t unSizeOfVRSelectedActionSet_t, uint32_t unSetCount, vr::VRInputValueHandle_t originToHighlight) override { return unused(); }
+	vr::EVRInputError GetComponentStateForBinding(const char* pchRenderModelName, const char* pchComponentName, const vr::InputBindingInfo_t* pOriginInfo, uint32_t unBindingInfoSize, uint32_t unBindingInfoCount, vr::RenderModel_ComponentState_t* pComponentState) override { return unused(); }
+	bool IsUsingLegacyInput() override { return false; }
+	vr::EVRInputError OpenBindingUI(const char* pchAppKey, vr::VRActionSetHandle_t ulActionSetHandle, vr::VRInputValueHandle_t ulDeviceHandle, bool bShowOnDesktop) override { return unused(); }
+	vr::EVRInputError GetBindingVariant(vr::VRInputValueHandle_t ulDevicePath, char* pchVariantArray, uint32_t unVariantArraySize) override { return unused(); }
+
+	std::string manifestPath;
+	std::string missingAction;
+	bool failUpdate = false;
+	uint32_t updateCalls = 0;
+	uint32_t lastSetCount = 0;
+	uint32_t unusedCalls = 0;
+
+private:
+	vr::VRActionHandle_t getHandle(const char* path)
+	{
+		get(path);
+		return (vr::VRActionHandle_t)(find(path) - actions.data()) + 1;
+	}
+
+	const Action* getUpdated(vr::VRActionHandle_t handle) const
+	{
+		if (handle == 0 || handle > updatedActions.size())
+			return nullptr;
+
+		return &updatedActions[(size_t)handle - 1];
+	}
+
+	vr::EVRInputError unused()
+	{
+		unusedCalls++;
+		return vr::VRInputError_InvalidParam;
+	}
+
+	//every path is created before the first update, so the addresses handed out by find() stay valid in a test
+	wi::vector<Action> actions;
+	wi::vector<Action> updatedActions;
+};
+
+static const char* manifest = "input/actions.json";
+
+static bool isPressed(const vr::VRControllerState_t& state, uint32_t buttonId)
+{
+	return (state.ulButtonPressed & vr::ButtonMaskFromId((vr::EVRButtonId)buttonId)) != 0;
+}
+
+static void testInit()
+{
+	MockInput mock;
+	EngineVrInput input;
+	check(input.init(&mock, manifest), "init", "every action of the manifest is found");
+	check(input.isInitialized(), "init", "the input is initialized");
+	check(mock.manifestPath.size() > strlen(manifest) && mock.manifestPath.find("actions.json") != std::string::npos, "init", "the runtime is given the absolute manifest path");
+	check(mock.updateCalls == 0, "init", "init does not update the actions");
+
+	MockInput incomplete;
+	incomplete.missingAction = "/actions/main/in/grip_right";
+	EngineVrInput refused;
+	check(!refused.init(&incomplete, manifest) && !refused.isInitialized(), "init", "a manifest missing an action is refused");
+	check(!refused.update(), "init", "an input that failed init never updates");
+	check(incomplete.updateCalls == 0, "init", "the runtime is not asked for updates after a failed init");
+}
+
+static void testOneUpdatePerFrame()
+{
+	MockInput mock;
+	EngineVrInput input;
+	input.init(&mock, manifest);
+
+	for (uint32_t frame = 0; frame < 5; ++frame)
+	{
+		check(input.update(), "one update per frame", "the update succeeds");
+	}
+	check(mock.updateCalls == 5, "one update per frame", "update() makes exactly one UpdateActionState");
+	check(mock.lastSetCount == 1, "one update per frame", "only the main set is active by default");
+	check(input.getState().updateCount == 5, "one update per frame", "every update is counted");
+	check(mock.unusedCalls == 0, "one update per frame", "only the action data calls are made");
+
+	check(input.setActionSetActive("/actions/menu", true), "one update per frame", "another set can be activated");
+	input.update();
+	check(mock.updateCalls == 6 && mock.lastSetCount == 2, "one update per frame", "active sets share the single update");
+	check(input.setActionSetActive("/actions/menu", false), "one update per frame", "a set can be deactivated");
+	check(!input.setActionSetActive("/actions/main", false), "one update per frame", "the main set stays active");
+	input.update();
+	check(mock.lastSetCount == 1, "one update per frame", "a deactivated set is not updated");
+}
+
+static void testLegacyMapping()
+{
+	MockInput mock;
+	EngineVrInput input;
+	input.init(&mock, manifest);
+
+	const char* leftActions[] = { "/actions/main/in/trigger_left", "/actions/main/in/grip_left", "/actions/main/in/primary_left", "/actions/main/in/secondary_left" };
+	const uint32_t legacyIds[] = { 33, 2, 7, 1 };
+	for (int action = 0; action < EngineVrInput::DIGITAL_COUNT; ++action)
+	{
+		for (int other = 0; other < EngineVrInput::DIGITAL_COUNT; ++other)
+		{
+			mock.get(leftActions[other]).pressed = other == action;
+		}
+		input.update();
+
+		vr::VRControllerState_t left;
+		vr::VRControllerState_t right;
+		input.writeControllerState(EngineVrInput::HAND_LEFT, left);
+		input.writeControllerState(EngineVrInput::HAND_RIGHT, right);
+		for (int id = 0; id < EngineVrInput::DIGITAL_COUNT; ++id)
+		{
+			check(isPressed(left, legacyIds[id]) == (id == action), "legacy mapping", "each digital action sets its legacy button id and only it");
+		}
+		check(right.ulButtonPressed == 0, "legacy mapping", "the other hand stays released");
+	}
+
+	mock.get("/actions/main/in/secondary_left").pressed = false;
+	mock.get("/actions/main/in/trigger_right").pressed = true;
+	mock.get("/actions/main/in/pad_right").axis = XMFLOAT2(0.25f, -0.5f);
+	input.update();
+
+	vr::VRControllerState_t right;
+	input.writeControllerState(EngineVrInput::HAND_RIGHT, right);
+	check(isPressed(right, 33), "legacy mapping", "the right trigger is button 33");
+	check(right.rAxis[0].x == 0.25f && right.rAxis[0].y == -0.5f, "legacy mapping", "the pad action is axis 0");
+	check(right.unPacketNum == (uint32_t)input.getState().updateCount, "legacy mapping", "the packet number follows the updates");
+
+	//an action the current binding does not drive reads as released
+	mock.get("/actions/main/in/trigger_right").active = false;
+	mock.get("/actions/main/in/pad_right").active = false;
+	input.update();
+	input.writeControllerState(EngineVrInput::HAND_RIGHT, right);
+	check(!isPressed(right, 33), "legacy mapping", "an inactive action is released");
+	check(right.rAxis[0].x == 0.0f && right.rAxis[0].y == 0.0f, "legacy mapping", "an inactive pad is centered");
+}
+
+static void testPoseAndFailedUpdate()
+{
+	MockInput mock;
+	EngineVrInput input;
+	input.init(&mock, manifest);
+
+	MockInput::Action& pose = mock.get("/actions/main/in/pose_left");
+	pose.poseValid = true;
+	pose.pose.m[0][0] = 1.0f;
+	pose.pose.m[1][1] = 1.0f;
+	pose.pose.m[2][2] = 1.0f;
+	pose.pose.m[1][3] = 1.2f;
+	mock.get("/actions/main/in/grip_left").pressed = true;
+	input.update();
+
+	const EngineVrInput::HandState& left = input.getState().hands[EngineVrInput::HAND_LEFT];
+	check(left.poseValid && left.pose.m[1][3] == 1.2f, "pose", "the pose action is read for the next frame");
+	check(!input.getState().hands[EngineVrInput::HAND_RIGHT].poseValid, "pose", "a hand without pose stays invalid");
+
+	//a refused update keeps the previous state
+	mock.failUpdate = true;
+	mock.get("/actions/main/in/grip_left").pressed = false;
+	check(!input.update(), "failed update", "a refused update is reported");
+	vr::VRControllerState_t state;
+	input.writeControllerState(EngineVrInput::HAND_LEFT, state);
+	check(isPressed(state, 2) && input.getState().updateCount == 1, "failed update", "the previous state is kept");
+}
+
+int main()
+{
+	testInit();
+	testOneUpdatePerFrame();
+	testLegacyMapping();
+	testPoseAndFailedUpdate();
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
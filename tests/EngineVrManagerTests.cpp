@@ -0,0 +1,213 @@
+#include "WickedEngine.h"
+#include "EngineVrManager.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+//Frame loop of EngineVrManager without a headset: a synthetic recording is replayed, so the session submits through the Null backend.
+//The descriptor cache of the Null submitter is checked on its own first, without a graphics device.
+//Built with ENGINEVR_COUNT_ALLOCATIONS, so the steady state frames are also checked for heap allocations.
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+//A texture the submitter can cache, no graphics device behind it
+static wi::graphics::Texture makeTexture(uint32_t width, uint32_t height)
+{
+	wi::graphics::Texture texture;
+	texture.desc.width = width;
+	texture.desc.height = height;
+	texture.internal_state = std::make_shared<int>(0);
+	return texture;
+}
+
+static void testNullSubmitter()
+{
+	EngineVrSubmitterT<EngineVrBackendNull> submitter;
+	check(submitter.init(), "null submitter", "the Null backend always initializes");
+	check(strcmp(submitter.getName(), "Null") == 0, "null submitter", "the backend name is reported");
+
+	wi::graphics::Texture left = makeTexture(128, 128);
+	wi::graphics::Texture right = makeTexture(128, 128);
+	for (int frame = 0; frame < 10; ++frame)
+	{
+		submitter.submit(left, right);
+	}
+	check(submitter.getSubmittedFrames() == 10, "null submitter", "every frame is counted");
+	check(submitter.getDescriptorRebuilds() == 2, "null submitter", "each eye slot is described once while its texture stays the same");
+
+	vr::Texture_t first;
+	vr::Texture_t second;
+	submitter.describe(EngineVrSubmitter::SLOT_LEFT_EYE, left, first);
+	submitter.describe(EngineVrSubmitter::SLOT_LEFT_EYE, left, second);
+	check(first.handle != nullptr && first.handle == second.handle, "null submitter", "the cached descriptor keeps its address");
+
+	//a resized eye target is a new texture
+	wi::graphics::Texture resizedLeft = makeTexture(256, 256);
+	submitter.submit(resizedLeft, right);
+	submitter.submit(resizedLeft, right);
+	check(submitter.getDescriptorRebuilds() == 3, "null submitter", "only the slot whose texture changed is described again");
+
+	vr::Texture_t invalid;
+	check(!submitter.describe(EngineVrSubmitter::SLOT_LEFT_EYE, wi::graphics::Texture(), invalid), "null submitter", "an empty texture is not described");
+	check(!submitter.describe(EngineVrSubmitter::SLOT_COUNT, left, invalid), "null submitter", "a slot out of range is refused");
+	check(submitter.getSubmittedFrames() == 12, "null submitter", "describe does not count as a submit");
+}
+
+static const uint32_t replayFrames = 30;
+static const uint32_t warmUpFrames = 5;
+
+//HMD standing still at 1.6m, 256x256 per eye at 90 Hz
+static void writeReplay(const std::string& fileName)
+{
+	VrRecordHeader header;
+	header.width = 256;
+	header.height = 256;
+	header.displayFrequency = 90.0f;
+	for (int eye = vr::Eye_Left; eye <= vr::Eye_Right; ++eye)
+	{
+		header.projectionRaw[eye][0] = -1.0f;
+		header.projectionRaw[eye][1] = 1.0f;
+		header.projectionRaw[eye][2] = -1.0f;
+		header.projectionRaw[eye][3] = 1.0f;
+
+		vr::HmdMatrix34_t eyeToHead = {};
+		eyeToHead.m[0][0] = 1.0f;
+		eyeToHead.m[1][1] = 1.0f;
+		eyeToHead.m[2][2] = 1.0f;
+		eyeToHead.m[0][3] = eye == vr::Eye_Left ? -0.032f : 0.032f;
+		header.setEyeToHead((vr::Hmd_Eye)eye, eyeToHead);
+	}
+
+	EngineVrRecorder recorder;
+	recorder.start(fileName, header);
+
+	VrRecordFrame frame;
+	for (uint32_t i = 0; i < replayFrames; ++i)
+	{
+		frame.frameIndex = i;
+		frame.dt = 1.0f / 90.0f;
+		frame.deviceCount = 1;
+
+		VrRecordDevice& device = frame.devices[0];
+		device = VrRecordDevice();
+		device.index = vr::k_unTrackedDeviceIndex_Hmd;
+		device.deviceClass = vr::TrackedDeviceClass_HMD;
+		device.deviceToAbsolute[0][0] = 1.0f;
+		device.deviceToAbsolute[1][1] = 1.0f;
+		device.deviceToAbsolute[2][2] = 1.0f;
+		device.deviceToAbsolute[1][3] = 1.6f;
+		device.trackingResult = vr::TrackingResult_Running_OK;
+		device.poseIsValid = 1;
+		device.deviceIsConnected = 1;
+		recorder.push(frame);
+	}
+	recorder.stop();
+}
+
+//The hidden window only exists to give wi::Application a graphics device, nothing is presented
+static bool createDevice(wi::Application& application)
+{
+#ifdef _WIN32
+	HWND window = CreateWindowExW(0, L"STATIC", L"EngineVrManagerTests", WS_OVERLAPPEDWINDOW, 0, 0, 256, 256, nullptr, nullptr, GetModuleHandle(nullptr), nullptr);
+	if (window == nullptr)
+		return false;
+	application.SetWindow(window);
+#elif defined(SDL2)
+	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+		return false;
+	SDL_Window* window = SDL_CreateWindow("EngineVrManagerTests", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 256, 256, SDL_WINDOW_HIDDEN | SDL_WINDOW_VULKAN);
+	if (window == nullptr)
+		return false;
+	application.SetWindow(window);
+#else
+	return false;
+#endif
+	return wi::graphics::GetDevice() != nullptr;
+}
+
+//render() of the application frame, with the command lists handed to the GPU like wi::Application::Run does
+static void renderFrame(EngineVrManager* manager)
+{
+	manager->render(1.0f / 90.0f);
+	wi::graphics::GetDevice()->SubmitCommandLists();
+}
+
+static void testReplaySession(const std::string& replayFile)
+{
+	writeReplay(replayFile);
+
+	EngineVrManager* manager = EngineVrManager::getInstance();
+	check(manager->startReplay(replayFile), "replay session", "the synthetic recording opens");
+	manager->startVrSession(wi::scene::GetScene());
+	check(manager->isVrSessionActive(), "replay session", "the session starts without a runtime");
+	check(strcmp(manager->getSubmitBackendName(), "Null") == 0, "replay session", "a replay submits through the Null backend");
+
+	renderFrame(manager);
+	renderFrame(manager);
+	uint64_t warmRebuilds = manager->getSubmitDescriptorRebuilds();
+	uint32_t steadyAllocations = 0;
+	for (uint32_t frame = 2; frame < replayFrames; ++frame)
+	{
+		renderFrame(manager);
+		//targets, caches and arena are sized by then
+		if (frame >= warmUpFrames)
+		{
+			steadyAllocations += manager->getFrameStats().heapAllocations;
+		}
+	}
+
+	check(manager->getSubmittedFrameCount() == replayFrames, "replay session", "every rendered frame is submitted once");
+	check(warmRebuilds >= 2, "replay session", "both eye slots are described");
+	check(manager->getSubmitDescriptorRebuilds() == warmRebuilds, "replay session", "the eye descriptors are not rebuilt while the eye textures stay the same");
+	check(manager->isReplayFinished(), "replay session", "every recorded frame was played");
+	check(EngineVrAllocations::isCounting(), "replay session", "the test is built with ENGINEVR_COUNT_ALLOCATIONS");
+	check(steadyAllocations == 0, "replay session", "a steady state frame makes no heap allocation on the frame thread outside the Wicked calls");
+
+	manager->stopVrSession();
+	manager->stopReplay();
+	EngineVrManager::removeInstance();
+}
+
+int main()
+{
+	testNullSubmitter();
+
+	wi::Application application;
+	if (createDevice(application))
+	{
+		wi::renderer::SetShaderSourcePath(WICKED_ENGINE_SHADER_SOURCE_DIR);
+		wi::renderer::SetShaderPath(ENGINEVR_TESTS_SHADER_DIR);
+		wi::initializer::InitializeComponentsImmediate();
+
+		std::string replayFile = (std::filesystem::temp_directory_path() / "EngineVrManagerTests.vrrec").string();
+		testReplaySession(replayFile);
+		std::filesystem::remove(replayFile);
+	}
+	else
+	{
+		printf("no graphics device, the replay session is skipped\n");
+	}
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
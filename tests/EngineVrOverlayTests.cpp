@@ -0,0 +1,282 @@
+#include "WickedEngine.h"
+#include "EngineVrOverlay.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+//Update scheduling of EngineVrOverlayLayers against a mock overlay api, on the Null submitter.
+//Transforms and visibility are checked without a graphics device, the redraws and texture uploads need one (a hidden window is created).
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+//Counts the calls made for each overlay handle
+class MockOverlayApi : public EngineVrOverlayApi
+{
+public:
+	struct Overlay
+	{
+		bool alive = true;
+		bool visible = false;
+		uint32_t transforms = 0;
+		uint32_t visibilityChanges = 0;
+		uint32_t textures = 0;
+		void* lastTexture = nullptr;
+		uint32_t textureSwaps = 0;
+		vr::HmdMatrix34_t transform = {};
+		bool headRelative = false;
+	};
+
+	bool createOverlay(const char* key, const char* name, vr::VROverlayHandle_t& handle) override
+	{
+		overlays.push_back(Overlay());
+		handle = overlays.size();
+		return true;
+	}
+
+	void destroyOverlay(vr::VROverlayHandle_t handle) override
+	{
+		get(handle).alive = false;
+	}
+
+	void setTexture(vr::VROverlayHandle_t handle, const vr::Texture_t& texture) override
+	{
+		Overlay& overlay = get(handle);
+		overlay.textures++;
+		if (overlay.lastTexture != nullptr && overlay.lastTexture != texture.handle)
+		{
+			overlay.textureSwaps++;
+		}
+		overlay.lastTexture = texture.handle;
+	}
+
+	void setTransform(vr::VROverlayHandle_t handle, const vr::HmdMatrix34_t& transform, bool headRelative) override
+	{
+		Overlay& overlay = get(handle);
+		overlay.transforms++;
+		overlay.transform = transform;
+		overlay.headRelative = headRelative;
+	}
+
+	void setWidth(vr::VROverlayHandle_t handle, float meters) override
+	{
+	}
+
+	void setVisible(vr::VROverlayHandle_t handle, bool visible) override
+	{
+		Overlay& overlay = get(handle);
+		overlay.visibilityChanges++;
+		overlay.visible = visible;
+	}
+
+	Overlay& get(vr::VROverlayHandle_t handle)
+	{
+		return overlays[(size_t)handle - 1];
+	}
+
+	wi::vector<Overlay> overlays;
+};
+
+static const float frameTime = 1.0f / 90.0f;
+
+static void testSchedule()
+{
+	float timeSinceRedraw = 0.0f;
+	uint32_t redraws = 0;
+	bool everyThirdFrame = true;
+	for (uint32_t frame = 0; frame < 900; ++frame)
+	{
+		bool due = EngineVrOverlayLayers::schedule(30.0f, false, frameTime, timeSinceRedraw);
+		everyThirdFrame = everyThirdFrame && due == (frame % 3 == 2);
+		redraws += due ? 1 : 0;
+	}
+	check(redraws == 300 && everyThirdFrame, "schedule", "a 30 Hz layer on a 90 Hz loop is redrawn exactly every third frame");
+
+	timeSinceRedraw = 0.0f;
+	redraws = 0;
+	for (uint32_t frame = 0; frame < 90; ++frame)
+	{
+		redraws += EngineVrOverlayLayers::schedule(0.0f, frame == 40, frameTime, timeSinceRedraw) ? 1 : 0;
+	}
+	check(redraws == 1, "schedule", "a layer at rate 0 is only redrawn when dirty");
+}
+
+static void testTransforms()
+{
+	std::shared_ptr<MockOverlayApi> api = std::make_shared<MockOverlayApi>();
+	EngineVrOverlayLayers layers;
+	layers.setApi(api);
+
+	EngineVrOverlayLayers::LayerDesc worldDesc;
+	int world = layers.createLayer(worldDesc, EngineVrOverlayLayers::DrawCallback());
+	EngineVrOverlayLayers::LayerDesc headDesc;
+	headDesc.anchor = EngineVrOverlayLayers::ANCHOR_HEAD;
+	int head = layers.createLayer(headDesc, EngineVrOverlayLayers::DrawCallback());
+	layers.setLayerTransform(world, XMMatrixTranslation(0, 1.5f, 2));
+	layers.setLayerTransform(head, XMMatrixTranslation(0, 0, 1));
+
+	XMMATRIX rig = XMMatrixIdentity();
+	layers.update(frameTime, rig, nullptr);
+	check(api->overlays.size() == 2, "transforms", "a runtime overlay is created per layer");
+	MockOverlayApi::Overlay& worldOverlay = api->get(1);
+	MockOverlayApi::Overlay& headOverlay = api->get(2);
+	check(worldOverlay.transforms == 1 && headOverlay.transforms == 1, "transforms", "the first update places every layer");
+	check(!worldOverlay.headRelative && headOverlay.headRelative, "transforms", "each layer is placed in its anchor space");
+	check(worldOverlay.transform.m[2][3] == -2.0f, "transforms", "the world transform is converted to the right handed tracking space");
+
+	for (int frame = 0; frame < 10; ++frame)
+	{
+		layers.update(frameTime, rig, nullptr);
+	}
+	check(worldOverlay.transforms == 1 && headOverlay.transforms == 1, "transforms", "nothing is sent again while the rig and layers stay still");
+
+	//the player moved: world layers stay in place in the world, so they move in tracking space
+	rig = XMMatrixTranslation(1, 0, 0);
+	layers.update(frameTime, rig, nullptr);
+	check(worldOverlay.transforms == 2, "transforms", "a rig change sends the world anchored layers again");
+	check(worldOverlay.transform.m[0][3] == -1.0f, "transforms", "the world layer is placed relative to the new rig");
+	check(headOverlay.transforms == 1, "transforms", "head anchored layers do not follow the rig");
+
+	layers.setLayerTransform(head, XMMatrixTranslation(0, 0, 2));
+	layers.update(frameTime, rig, nullptr);
+	check(headOverlay.transforms == 2 && worldOverlay.transforms == 2, "transforms", "a moved layer is the only one sent again");
+
+	layers.setApi(nullptr);
+	check(!worldOverlay.alive && !headOverlay.alive, "transforms", "the runtime overlays are destroyed with the api");
+}
+
+static void testVisibility()
+{
+	std::shared_ptr<MockOverlayApi> api = std::make_shared<MockOverlayApi>();
+	EngineVrOverlayLayers layers;
+	layers.setApi(api);
+
+	int layer = layers.createLayer(EngineVrOverlayLayers::LayerDesc(), EngineVrOverlayLayers::DrawCallback());
+	layers.update(frameTime, XMMatrixIdentity(), nullptr);
+	MockOverlayApi::Overlay& overlay = api->get(1);
+	check(overlay.visible && overlay.visibilityChanges == 1, "visibility", "a new layer is shown");
+
+	layers.setLayerVisible(layer, false);
+	layers.setLayerVisible(layer, false);
+	layers.update(frameTime, XMMatrixIdentity(), nullptr);
+	check(!overlay.visible && overlay.visibilityChanges == 2, "visibility", "hiding sends one change");
+
+	//a hidden layer is not placed or redrawn
+	uint32_t transforms = overlay.transforms;
+	layers.setLayerTransform(layer, XMMatrixTranslation(0, 2, 0));
+	layers.update(frameTime, XMMatrixTranslation(3, 0, 0), nullptr);
+	check(overlay.transforms == transforms, "visibility", "a hidden layer is not placed");
+	check(layers.getStats().redraws == 0 && layers.getStats().skippedRedraws == 0, "visibility", "a hidden layer is not scheduled");
+
+	layers.setLayerVisible(layer, true);
+	layers.update(frameTime, XMMatrixTranslation(3, 0, 0), nullptr);
+	check(overlay.visible && overlay.visibilityChanges == 3, "visibility", "showing sends one change");
+	check(overlay.transforms == transforms + 1, "visibility", "the transform changed while hidden is sent once shown");
+	layers.update(frameTime, XMMatrixTranslation(3, 0, 0), nullptr);
+	check(overlay.visibilityChanges == 3, "visibility", "an unchanged visibility is not sent again");
+}
+
+static void testRedraws()
+{
+	std::shared_ptr<MockOverlayApi> api = std::make_shared<MockOverlayApi>();
+	EngineVrSubmitterT<EngineVrBackendNull> submitter;
+	submitter.init();
+	EngineVrOverlayLayers layers;
+	layers.setApi(api);
+
+	uint32_t draws = 0;
+	EngineVrOverlayLayers::LayerDesc desc;
+	desc.width = 64;
+	desc.height = 64;
+	desc.updateRate = 30.0f;
+	int layer = layers.createLayer(desc, [&](wi::graphics::CommandList cmd) { draws++; });
+
+	//the first frame draws the new layer, then every third frame
+	uint32_t redraws = 0;
+	uint32_t skipped = 0;
+	for (uint32_t frame = 0; frame < 91; ++frame)
+	{
+		layers.update(frameTime, XMMatrixIdentity(), &submitter);
+		redraws += layers.getStats().redraws;
+		skipped += layers.getStats().skippedRedraws;
+	}
+	MockOverlayApi::Overlay& overlay = api->get(1);
+	check(redraws == 31 && skipped == 60 && draws == 31, "redraws", "a 30 Hz layer is drawn 30 times per second on a 90 Hz loop");
+	check(overlay.textures == 31, "redraws", "every redraw is uploaded to the compositor");
+	check(overlay.textureSwaps == 30, "redraws", "each redraw goes into the texture the compositor is not showing");
+	check(submitter.getDescriptorRebuilds() == EngineVrOverlayLayers::layerBufferCount, "redraws", "each layer texture is described once");
+
+	//dirty between two due frames: uploaded on the next frame
+	layers.setLayerDirty(layer);
+	layers.update(frameTime, XMMatrixIdentity(), &submitter);
+	check(layers.getStats().redraws == 1 && overlay.textures == 32, "redraws", "a dirty layer is redrawn and uploaded on the next frame");
+
+	layers.setLayerUpdateRate(layer, 0.0f);
+	uint32_t textures = overlay.textures;
+	for (uint32_t frame = 0; frame < 30; ++frame)
+	{
+		layers.update(frameTime, XMMatrixIdentity(), &submitter);
+	}
+	check(overlay.textures == textures, "redraws", "a layer at rate 0 is not uploaded again until dirty");
+
+	layers.clear();
+	layers.setApi(nullptr);
+}
+
+//The hidden window only exists to give wi::Application a graphics device, nothing is presented
+static bool createDevice(wi::Application& application)
+{
+#ifdef _WIN32
+	HWND window = CreateWindowExW(0, L"STATIC", L"EngineVrOverlayTests", WS_OVERLAPPEDWINDOW, 0, 0, 256, 256, nullptr, nullptr, GetModuleHandle(nullptr), nullptr);
+	if (window == nullptr)
+		return false;
+	application.SetWindow(window);
+#elif defined(SDL2)
+	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+		return false;
+	SDL_Window* window = SDL_CreateWindow("EngineVrOverlayTests", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 256, 256, SDL_WINDOW_HIDDEN | SDL_WINDOW_VULKAN);
+	if (window == nullptr)
+		return false;
+	application.SetWindow(window);
+#else
+	return false;
+#endif
+	return wi::graphics::GetDevice() != nullptr;
+}
+
+int main()
+{
+	testSchedule();
+	testTransforms();
+	testVisibility();
+
+	wi::Application application;
+	if (createDevice(application))
+	{
+		testRedraws();
+	}
+	else
+	{
+		printf("no graphics device, the redraws are skipped\n");
+	}
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include "WickedEngine.h"
+#include "EngineVrRayQuery.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+//Synthetic scene of 64 terrain tiles of 16384 triangles each (1M triangles), traced with hand-like ray pairs.
+//The BVH packet trace is timed against one trace per ray and Scene::Intersects,
+//then checked against Scene::Intersects and the brute force path.
+
+static const uint32_t tileCount = 8;
+static const uint32_t quadsX = 128;
+static const uint32_t quadsZ = 64;
+static const float tileSize = 32.0f;
+
+static float height(float x, float z)
+{
+	return std::sin(x * 0.3f) * std::cos(z * 0.2f) * 2.0f;
+}
+
+static void buildScene(wi::scene::Scene& scene)
+{
+	for (uint32_t tileZ = 0; tileZ < tileCount; ++tileZ)
+	{
+		for (uint32_t tileX = 0; tileX < tileCount; ++tileX)
+		{
+			XMFLOAT3 offset = XMFLOAT3(tileX * tileSize, 0, tileZ * tileSize);
+
+			wi::ecs::Entity meshEntity = wi::ecs::CreateEntity();
+			wi::scene::MeshComponent& mesh = scene.meshes.Create(meshEntity);
+			for (uint32_t z = 0; z <= quadsZ; ++z)
+			{
+				for (uint32_t x = 0; x <= quadsX; ++x)
+				{
+					float px = x * tileSize / quadsX;
+					float pz = z * tileSize / quadsZ;
+					mesh.vertex_positions.push_back(XMFLOAT3(px, height(offset.x + px, offset.z + pz), pz));
+				}
+			}
+			for (uint32_t z = 0; z < quadsZ; ++z)
+			{
+				for (uint32_t x = 0; x < quadsX; ++x)
+				{
+					uint32_t i0 = z * (quadsX + 1) + x;
+					uint32_t i1 = i0 + 1;
+					uint32_t i2 = i0 + quadsX + 1;
+					uint32_t i3 = i2 + 1;
+					mesh.indices.insert(mesh.indices.end(), { i0, i2, i1, i1, i2, i3 });
+				}
+			}
+			mesh.subsets.emplace_back();
+			mesh.subsets.back().indexOffset = 0;
+			mesh.subsets.back().indexCount = (uint32_t)mesh.indices.size();
+			mesh.aabb = wi::primitive::AABB(XMFLOAT3(0, -2, 0), XMFLOAT3(tileSize, 2, tileSize));
+			mesh.BuildBVH();
+
+			wi::ecs::Entity entity = wi::ecs::CreateEntity();
+			wi::scene::TransformComponent& transform = scene.transforms.Create(entity);
+			transform.Translate(offset);
+			transform.UpdateTransform();
+
+			wi::scene::ObjectComponent& object = scene.objects.Create(entity);
+			object.meshID = meshEntity;
+			object.filterMask = wi::enums::FILTER_OPAQUE;
+			scene.aabb_objects.push_back(mesh.aabb.transform(XMLoadFloat4x4(&transform.world)));
+		}
+	}
+
+	//what Scene::Update would compute, without needing a graphics device
+	for (size_t i = 0; i < scene.objects.GetCount(); ++i)
+	{
+		scene.objects[i].transform_index = (int)scene.transforms.GetIndex(scene.objects.GetEntity(i));
+	}
+	scene.BVH.Build(scene.aabb_objects.data(), (uint32_t)scene.aabb_objects.size());
+}
+
+//Two rays a hand width apart pointing roughly the same way, like the controller rays
+static void buildPackets(wi::vector<wi::primitive::Ray>& rays, uint32_t packetCount)
+{
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> position(4.0f, tileCount * tileSize - 4.0f);
+	std::uniform_real_distribution<float> spread(-0.3f, 0.3f);
+
+	for (uint32_t i = 0; i < packetCount; ++i)
+	{
+		XMVECTOR origin = XMVectorSet(position(random), 1.6f, position(random), 0);
+		XMVECTOR direction = XMVector3Normalize(XMVectorSet(spread(random), -0.5f, 1.0f, 0));
+		XMVECTOR handOffset = XMVectorSet(0.15f, 0, 0, 0);
+		XMVECTOR leftDirection = XMVector3Normalize(XMVectorAdd(direction, XMVectorSet(spread(random) * 0.1f, 0, 0, 0)));
+		rays.push_back(wi::primitive::Ray(XMVectorSubtract(origin, handOffset), leftDirection, 0.0f, 50.0f));
+		rays.push_back(wi::primitive::Ray(XMVectorAdd(origin, handOffset), direction, 0.0f, 50.0f));
+	}
+}
+
+static double traceAll(const wi::scene::Scene& scene, const wi::vector<wi::primitive::Ray>& rays, uint32_t packetCount, uint32_t raysPerTrace, wi::vector<wi::scene::Scene::RayIntersectionResult>& results)
+{
+	results.resize(rays.size());
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < packetCount * 2; i += raysPerTrace)
+	{
+		EngineVrRayQuery::trace(scene, &rays[i], raysPerTrace, wi::enums::FILTER_ALL, ~0u, &results[i]);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::micro>(end - begin).count() / packetCount;
+}
+
+static double intersectAll(const wi::scene::Scene& scene, const wi::vector<wi::primitive::Ray>& rays, uint32_t packetCount, wi::vector<wi::scene::Scene::RayIntersectionResult>& results)
+{
+	results.resize(rays.size());
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < packetCount * 2; ++i)
+	{
+		results[i] = scene.Intersects(rays[i], wi::enums::FILTER_ALL, ~0u);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::micro>(end - begin).count() / packetCount;
+}
+
+static bool isSameHit(const wi::scene::Scene::RayIntersectionResult& result, const wi::scene::Scene::RayIntersectionResult& expected, const wi::primitive::Ray& ray)
+{
+	//a hit past the ray length is no hit for the packet trace
+	bool expectedHit = expected.entity != wi::ecs::INVALID_ENTITY && expected.distance <= ray.TMax;
+	bool hit = result.entity != wi::ecs::INVALID_ENTITY;
+	if (hit != expectedHit)
+		return false;
+
+	return !hit || (result.entity == expected.entity && std::abs(result.distance - expected.distance) <= 1e-3f);
+}
+
+int main()
+{
+	wi::scene::Scene scene;
+	buildScene(scene);
+
+	size_t triangleCount = 0;
+	for (size_t i = 0; i < scene.meshes.GetCount(); ++i)
+	{
+		triangleCount += scene.meshes[i].indices.size() / 3;
+	}
+
+	const uint32_t packetCount = 2000;
+	const uint32_t bruteForcePackets = 20;
+	wi::vector<wi::primitive::Ray> rays;
+	buildPackets(rays, packetCount);
+
+	wi::vector<wi::scene::Scene::RayIntersectionResult> packetResults;
+	wi::vector<wi::scene::Scene::RayIntersectionResult> singleResults;
+	wi::vector<wi::scene::Scene::RayIntersectionResult> bruteForceResults;
+	wi::vector<wi::scene::Scene::RayIntersectionResult> wickedResults;
+
+	double packetTime = traceAll(scene, rays, packetCount, 2, packetResults);
+	double singleTime = traceAll(scene, rays, packetCount, 1, singleResults);
+	double wickedTime = intersectAll(scene, rays, packetCount, wickedResults);
+
+	for (size_t i = 0; i < scene.meshes.GetCount(); ++i)
+	{
+		scene.meshes[i].bvh = wi::BVH();
+	}
+	double bruteForceTime = traceAll(scene, rays, bruteForcePackets, 2, bruteForceResults);
+
+	printf("%zu triangles, %u packets of 2 rays\n", triangleCount, packetCount);
+	printf("BVH packet      : %10.2f us per packet\n", packetTime);
+	printf("BVH single rays : %10.2f us per packet\n", singleTime);
+	printf("Scene::Intersects: %9.2f us per packet\n", wickedTime);
+	printf("brute force     : %10.2f us per packet\n", bruteForceTime);
+
+	uint32_t hits = 0;
+	uint32_t mismatches = 0;
+	uint32_t wickedMismatches = 0;
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		const wi::scene::Scene::RayIntersectionResult& expected = i < bruteForcePackets * 2 ? bruteForceResults[i] : singleResults[i];
+		const wi::scene::Scene::RayIntersectionResult& result = packetResults[i];
+		if (result.entity != wi::ecs::INVALID_ENTITY)
+		{
+			hits++;
+		}
+		if (!isSameHit(result, expected, rays[i]))
+		{
+			mismatches++;
+		}
+		if (!isSameHit(result, wickedResults[i], rays[i]))
+		{
+			wickedMismatches++;
+		}
+	}
+
+	printf("%u hits, %u mismatches, %u mismatches with Scene::Intersects\n", hits, mismatches, wickedMismatches);
+	return mismatches == 0 && wickedMismatches == 0 && hits > 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include "WickedEngine.h"
+#include "EngineVrRecording.h"
+
+#include <cstdio>
+
+//Round trip of EngineVrRecorder and EngineVrReplay: frames with a varying number of devices are written,
+//then read back through the frame index and through the scan used for a file without index.
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+static const char* recordingFile = "EngineVrRecordingTests.vrrec";
+static const char* truncatedFile = "EngineVrRecordingTests_truncated.vrrec";
+static const uint32_t frameCount = 1000;
+
+static uint32_t getDeviceCount(uint32_t frameIndex)
+{
+	//every frame size up to a full frame, so blocks fill unevenly
+	return frameIndex == 500 ? VR_RECORD_MAX_DEVICES : frameIndex % 4;
+}
+
+static void makeFrame(uint32_t frameIndex, VrRecordFrame& frame)
+{
+	frame.frameIndex = frameIndex;
+	frame.dt = 1.0f / 90.0f + frameIndex * 0.0001f;
+	frame.deviceCount = getDeviceCount(frameIndex);
+	for (uint32_t i = 0; i < frame.deviceCount; ++i)
+	{
+		frame.devices[i] = VrRecordDevice();
+		frame.devices[i].index = i;
+		frame.devices[i].packetNum = frameIndex * 100 + i;
+		frame.devices[i].deviceToAbsolute[1][3] = 1.6f + i;
+		frame.devices[i].poseIsValid = 1;
+	}
+}
+
+static bool isSameFrame(const VrRecordFrame& a, const VrRecordFrame& b)
+{
+	if (a.frameIndex != b.frameIndex || a.dt != b.dt || a.deviceCount != b.deviceCount)
+		return false;
+
+	for (uint32_t i = 0; i < a.deviceCount; ++i)
+	{
+		if (a.devices[i].index != b.devices[i].index || a.devices[i].packetNum != b.devices[i].packetNum ||
+			a.devices[i].deviceToAbsolute[1][3] != b.devices[i].deviceToAbsolute[1][3] || a.devices[i].poseIsValid != b.devices[i].poseIsValid)
+			return false;
+	}
+	return true;
+}
+
+static bool readAllFrames(const EngineVrReplay& replay)
+{
+	VrRecordFrame expected;
+	VrRecordFrame frame;
+	for (uint32_t i = 0; i < frameCount; ++i)
+	{
+		makeFrame(i, expected);
+		float dt = 0.0f;
+		if (!replay.getFrame(i, frame) || !isSameFrame(frame, expected) || !replay.getFrameDt(i, dt) || dt != expected.dt)
+			return false;
+	}
+	return true;
+}
+
+static void testRoundTrip()
+{
+	VrRecordHeader header;
+	header.width = 1832;
+	header.height = 1920;
+	header.displayFrequency = 90.0f;
+
+	EngineVrRecorder recorder;
+	check(recorder.start(recordingFile, header), "round trip", "the recording starts");
+
+	size_t framesSize = 0;
+	VrRecordFrame frame;
+	for (uint32_t i = 0; i < frameCount; ++i)
+	{
+		makeFrame(i, frame);
+		recorder.push(frame);
+		framesSize += getVrRecordFrameSize(frame.deviceCount);
+	}
+	recorder.stop();
+	check(recorder.getDroppedFrames() == 0, "round trip", "no frame is dropped when the writer keeps up");
+
+	//only the devices in use are stored, plus the index
+	size_t expectedSize = sizeof(VrRecordHeader) + framesSize + frameCount * sizeof(uint64_t) + sizeof(VrRecordIndex);
+	FILE* file = fopen(recordingFile, "rb");
+	fseek(file, 0, SEEK_END);
+	size_t fileSize = (size_t)ftell(file);
+	fclose(file);
+	check(fileSize == expectedSize, "round trip", "the file holds the frame headers, the devices in use and the index");
+
+	EngineVrReplay replay;
+	check(replay.open(recordingFile), "round trip", "the replay opens");
+	check(replay.getHeader().width == 1832 && replay.getHeader().displayFrequency == 90.0f, "round trip", "the header is read back");
+	check(replay.getFrameCount() == frameCount, "round trip", "every frame is in the index");
+	check(readAllFrames(replay), "round trip", "every frame is read back by index");
+	check(!replay.getFrame(frameCount, frame), "round trip", "reading past the last frame fails");
+	replay.close();
+}
+
+static void testWithoutIndex()
+{
+	//a recording that was never stopped: same frames, no index at the end
+	FILE* source = fopen(recordingFile, "rb");
+	fseek(source, 0, SEEK_END);
+	size_t fileSize = (size_t)ftell(source);
+	fseek(source, 0, SEEK_SET);
+	size_t truncatedSize = fileSize - frameCount * sizeof(uint64_t) - sizeof(VrRecordIndex);
+	wi::vector<uint8_t> bytes(truncatedSize);
+	size_t read = fread(bytes.data(), 1, truncatedSize, source);
+	fclose(source);
+
+	FILE* destination = fopen(truncatedFile, "wb");
+	fwrite(bytes.data(), 1, read, destination);
+	fclose(destination);
+
+	EngineVrReplay replay;
+	check(replay.open(truncatedFile), "without index", "the replay opens");
+	check(replay.getFrameCount() == frameCount, "without index", "every frame is found by the scan");
+	check(readAllFrames(replay), "without index", "every frame is read back");
+	replay.close();
+}
+
+int main()
+{
+	testRoundTrip();
+	testWithoutIndex();
+
+	remove(recordingFile);
+	remove(truncatedFile);
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,248 @@
+#include "WickedEngine.h"
+#include "EngineVrRenderModels.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+//Conversion of runtime render models and the .wirm disk cache, the runtime is replaced by a mock provider.
+//No slot is given a scene, so no GPU texture is ever created.
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+//One quad, right handed like the runtime models
+static const vr::RenderModel_Vertex_t quadVertices[] = {
+	{ { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0 } },
+	{ { 1, 0, 1 }, { 0, 0, 1 }, { 1, 0 } },
+	{ { 1, 1, 1 }, { 0, 0, 1 }, { 1, 1 } },
+	{ { 0, 1, 1 }, { 0, 0, 1 }, { 0, 1 } },
+};
+static const uint16_t quadIndices[] = { 0, 1, 2, 0, 2, 3 };
+
+static vr::RenderModel_t makeModel(vr::TextureID_t textureId)
+{
+	vr::RenderModel_t model = {};
+	model.rVertexData = quadVertices;
+	model.unVertexCount = 4;
+	model.rIndexData = quadIndices;
+	model.unTriangleCount = 2;
+	model.diffuseTextureId = textureId;
+	return model;
+}
+
+//texture data sized exactly for the first mip, reading past it would be caught by the sanitizers
+static vr::RenderModel_TextureMap_t makeTexture(vr::EVRRenderModelTextureFormat format, uint16_t width, uint16_t height, wi::vector<uint8_t>& pixels, size_t size)
+{
+	pixels.resize(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		pixels[i] = (uint8_t)i;
+	}
+
+	vr::RenderModel_TextureMap_t texture = {};
+	texture.unWidth = width;
+	texture.unHeight = height;
+	texture.rubTextureMapData = pixels.data();
+	texture.format = format;
+	texture.unMipLevels = 1;
+	return texture;
+}
+
+//Models load after a few polls, like LoadRenderModel_Async, and every runtime call is counted
+class MockRenderModelProvider : public EngineVrRenderModelProvider
+{
+public:
+	MockRenderModelProvider()
+	{
+		model = makeModel(1);
+		texture = makeTexture(vr::VRRenderModelTextureFormat_BC7_SRGB, 8, 8, pixels, 4 * 16);
+	}
+
+	vr::EVRRenderModelError loadRenderModel(const char* name, vr::RenderModel_t** result) override
+	{
+		modelLoads++;
+		if (failLoads)
+			return vr::VRRenderModelError_NotSupported;
+		if (modelLoads < 3)
+			return vr::VRRenderModelError_Loading;
+
+		*result = &model;
+		return vr::VRRenderModelError_None;
+	}
+
+	vr::EVRRenderModelError loadTexture(vr::TextureID_t id, vr::RenderModel_TextureMap_t** result) override
+	{
+		textureLoads++;
+		if (textureLoads < 2)
+			return vr::VRRenderModelError_Loading;
+
+		*result = &texture;
+		return vr::VRRenderModelError_None;
+	}
+
+	void freeRenderModel(vr::RenderModel_t* value) override
+	{
+		modelFrees++;
+	}
+
+	void freeTexture(vr::RenderModel_TextureMap_t* value) override
+	{
+		textureFrees++;
+	}
+
+	bool failLoads = false;
+	uint32_t modelLoads = 0;
+	uint32_t textureLoads = 0;
+	uint32_t modelFrees = 0;
+	uint32_t textureFrees = 0;
+
+private:
+	vr::RenderModel_t model;
+	vr::RenderModel_TextureMap_t texture;
+	wi::vector<uint8_t> pixels;
+};
+
+static void testConvertGeometry()
+{
+	vr::RenderModel_t model = makeModel(-1);
+	EngineVrRenderModels::Data data;
+	check(EngineVrRenderModels::convert(model, nullptr, data), "convert geometry", "a model without texture converts");
+	check(data.positions.size() == 4 && data.indices.size() == 6, "convert geometry", "every vertex and index is kept");
+	check(data.positions[1].x == 1.0f && data.positions[1].z == -1.0f && data.normals[1].z == -1.0f, "convert geometry", "z is flipped to left handed");
+	check(data.indices[0] == 0 && data.indices[1] == 2 && data.indices[2] == 1, "convert geometry", "the winding is flipped with z");
+	check(data.texture.empty(), "convert geometry", "no texture without texture map");
+
+	vr::RenderModel_t empty = {};
+	check(!EngineVrRenderModels::convert(empty, nullptr, data), "convert geometry", "an empty model is refused");
+}
+
+static void testConvertTextures()
+{
+	vr::RenderModel_t model = makeModel(1);
+	EngineVrRenderModels::Data data;
+	wi::vector<uint8_t> pixels;
+
+	vr::RenderModel_TextureMap_t rgba = makeTexture(vr::VRRenderModelTextureFormat_RGBA8_SRGB, 4, 2, pixels, 4 * 2 * 4);
+	check(EngineVrRenderModels::convert(model, &rgba, data), "convert textures", "RGBA8 converts");
+	check(data.texture.size() == 32 && data.texture[31] == 31 && data.textureFormat == vr::VRRenderModelTextureFormat_RGBA8_SRGB, "convert textures", "RGBA8 is copied as is");
+
+	wi::graphics::Format format;
+	uint32_t rowPitch;
+	size_t size;
+	EngineVrRenderModels::getTextureLayout(vr::VRRenderModelTextureFormat_RGBA8_SRGB, 4, 2, format, rowPitch, size);
+	check(format == wi::graphics::Format::R8G8B8A8_UNORM_SRGB && rowPitch == 16, "convert textures", "RGBA8 becomes an sRGB texture");
+
+	//6x6 rounds up to 2x2 blocks
+	vr::RenderModel_TextureMap_t bc7 = makeTexture(vr::VRRenderModelTextureFormat_BC7, 6, 6, pixels, 4 * 16);
+	check(EngineVrRenderModels::convert(model, &bc7, data), "convert textures", "BC7 converts");
+	check(data.texture.size() == 64 && data.textureFormat == vr::VRRenderModelTextureFormat_BC7, "convert textures", "only the BC7 blocks of the first mip are copied");
+	EngineVrRenderModels::getTextureLayout(vr::VRRenderModelTextureFormat_BC7, 6, 6, format, rowPitch, size);
+	check(format == wi::graphics::Format::BC7_UNORM && rowPitch == 32, "convert textures", "BC7 stays block compressed");
+
+	vr::RenderModel_TextureMap_t bc4 = makeTexture(vr::VRRenderModelTextureFormat_BC4, 8, 4, pixels, 2 * 8);
+	check(EngineVrRenderModels::convert(model, &bc4, data) && data.texture.size() == 16, "convert textures", "BC4 blocks are 8 bytes");
+
+	vr::RenderModel_TextureMap_t unknown = makeTexture((vr::EVRRenderModelTextureFormat)1000, 4, 4, pixels, 4);
+	check(EngineVrRenderModels::convert(model, &unknown, data), "convert textures", "a model with an unknown texture format still converts");
+	check(data.texture.empty() && data.textureWidth == 0, "convert textures", "an unknown texture format is dropped, not read");
+}
+
+static void testCacheFile(const std::string& directory)
+{
+	vr::RenderModel_t model = makeModel(1);
+	wi::vector<uint8_t> pixels;
+	vr::RenderModel_TextureMap_t bc7 = makeTexture(vr::VRRenderModelTextureFormat_BC7_SRGB, 8, 8, pixels, 4 * 16);
+	EngineVrRenderModels::Data data;
+	EngineVrRenderModels::convert(model, &bc7, data);
+
+	std::string fileName = directory + "/cache_file.wirm";
+	check(EngineVrRenderModels::writeCache(fileName, data), "cache file", "the cache is written");
+
+	EngineVrRenderModels::Data read;
+	check(EngineVrRenderModels::readCache(fileName, read), "cache file", "the cache is read back");
+	check(read.positions.size() == data.positions.size() && read.indices == data.indices && read.texture == data.texture, "cache file", "geometry and texture survive the cache");
+	check(read.textureFormat == vr::VRRenderModelTextureFormat_BC7_SRGB && read.textureWidth == 8 && read.textureHeight == 8, "cache file", "the texture format survives the cache");
+
+	//a truncated file is a cache miss, not a crash
+	wi::vector<uint8_t> bytes;
+	wi::helper::FileRead(fileName, bytes);
+	bytes.resize(bytes.size() - 1);
+	wi::helper::FileWrite(fileName, bytes.data(), bytes.size());
+	check(!EngineVrRenderModels::readCache(fileName, read), "cache file", "a truncated cache is refused");
+}
+
+static void updateUntil(EngineVrRenderModels& models, const std::function<bool()>& done)
+{
+	for (int i = 0; i < 1000 && !done(); ++i)
+	{
+		models.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+static void testAsyncLoad(const std::string& directory)
+{
+	std::shared_ptr<MockRenderModelProvider> provider = std::make_shared<MockRenderModelProvider>();
+	{
+		EngineVrRenderModels models;
+		models.setCacheDirectory(directory);
+		models.setProvider(provider);
+		models.setSlotModel(0, "mock_controller");
+		updateUntil(models, [&]() { return models.getStats().runtimeLoads + models.getStats().failures > 0; });
+
+		check(models.getStats().runtimeLoads == 1 && models.getStats().cacheHits == 0, "async load", "the first session loads from the runtime");
+		check(provider->modelLoads == 3 && provider->textureLoads == 2, "async load", "the runtime is polled until the model and texture are loaded");
+		check(provider->modelFrees == 1 && provider->textureFrees == 1, "async load", "the runtime memory is released after conversion");
+		check(std::filesystem::exists(directory + "/mock_controller.wirm"), "async load", "the converted model is cached on disk");
+	}
+
+	//next session: the runtime is not asked again
+	provider->failLoads = true;
+	uint32_t loadsBefore = provider->modelLoads;
+	{
+		EngineVrRenderModels models;
+		models.setCacheDirectory(directory);
+		models.setProvider(provider);
+		models.setSlotModel(0, "mock_controller");
+		updateUntil(models, [&]() { return models.getStats().cacheHits + models.getStats().failures > 0; });
+
+		check(models.getStats().cacheHits == 1 && models.getStats().failures == 0, "async load", "the second session reads the cache");
+		check(provider->modelLoads == loadsBefore, "async load", "the runtime is not asked for a cached model");
+	}
+}
+
+int main()
+{
+	wi::jobsystem::Initialize();
+
+	std::string directory = (std::filesystem::temp_directory_path() / "EngineVrRenderModelsTests").string();
+	std::filesystem::remove_all(directory);
+
+	testConvertGeometry();
+	testConvertTextures();
+	testCacheFile(directory);
+	testAsyncLoad(directory);
+
+	std::filesystem::remove_all(directory);
+	wi::jobsystem::ShutDown();
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
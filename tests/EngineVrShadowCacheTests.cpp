@@ -0,0 +1,242 @@
+#include "WickedEngine.h"
+#include "EngineVrShadowCache.h"
+
+#include <algorithm>
+#include <cstdio>
+
+//Invalidation sets of EngineVrShadowCache on small synthetic scenes: two point lights far apart,
+//a directional light added in its own case, and unit box casters moved, added and removed between frames.
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+class SyntheticScene
+{
+public:
+	wi::scene::Scene scene;
+
+	wi::ecs::Entity addCaster(const XMFLOAT3& center, bool skinned = false)
+	{
+		wi::ecs::Entity entity = wi::ecs::CreateEntity();
+		wi::scene::ObjectComponent& object = scene.objects.Create(entity);
+		object.SetCastShadow(true);
+		if (skinned)
+		{
+			object.meshID = wi::ecs::CreateEntity();
+			scene.meshes.Create(object.meshID).armatureID = wi::ecs::CreateEntity();
+		}
+		moveCaster(entity, center);
+		return entity;
+	}
+
+	void moveCaster(wi::ecs::Entity entity, const XMFLOAT3& center)
+	{
+		centers[entity] = center;
+		syncBounds();
+	}
+
+	void removeCaster(wi::ecs::Entity entity)
+	{
+		scene.Entity_Remove(entity);
+		centers.erase(entity);
+		syncBounds();
+	}
+
+	wi::ecs::Entity addLight(wi::scene::LightComponent::LightType type, const XMFLOAT3& position, float range)
+	{
+		wi::ecs::Entity entity = wi::ecs::CreateEntity();
+		wi::scene::LightComponent& light = scene.lights.Create(entity);
+		light.SetType(type);
+		light.SetCastShadow(true);
+		light.position = position;
+		light.range = range;
+		syncBounds();
+		return entity;
+	}
+
+	void moveLight(wi::ecs::Entity entity, const XMFLOAT3& position)
+	{
+		scene.lights.GetComponent(entity)->position = position;
+		syncBounds();
+	}
+
+	//what Scene::Update would compute, in component order
+	void syncBounds()
+	{
+		scene.aabb_objects.resize(scene.objects.GetCount());
+		for (size_t i = 0; i < scene.objects.GetCount(); ++i)
+		{
+			const XMFLOAT3& center = centers[scene.objects.GetEntity(i)];
+			scene.aabb_objects[i] = wi::primitive::AABB(XMFLOAT3(center.x - 0.5f, center.y - 0.5f, center.z - 0.5f), XMFLOAT3(center.x + 0.5f, center.y + 0.5f, center.z + 0.5f));
+		}
+
+		scene.aabb_lights.resize(scene.lights.GetCount());
+		for (size_t i = 0; i < scene.lights.GetCount(); ++i)
+		{
+			const wi::scene::LightComponent& light = scene.lights[i];
+			float range = light.GetType() == wi::scene::LightComponent::DIRECTIONAL ? 10000.0f : light.GetRange();
+			scene.aabb_lights[i] = wi::primitive::AABB(XMFLOAT3(light.position.x - range, light.position.y - range, light.position.z - range), XMFLOAT3(light.position.x + range, light.position.y + range, light.position.z + range));
+		}
+	}
+
+	//builds the next frame invalidation set, returns the number of moving casters
+	uint32_t nextFrame()
+	{
+		const EngineVrShadowCache::SceneState& previous = states[current];
+		current ^= 1;
+		dirtyLights.clear();
+		return EngineVrShadowCache::buildInvalidationSet(scene, previous, states[current], dirtyLights);
+	}
+
+	bool isDirty(wi::ecs::Entity entity) const
+	{
+		return std::find(dirtyLights.begin(), dirtyLights.end(), entity) != dirtyLights.end();
+	}
+
+	wi::vector<wi::ecs::Entity> dirtyLights;
+
+private:
+	wi::unordered_map<wi::ecs::Entity, XMFLOAT3> centers;
+	EngineVrShadowCache::SceneState states[2];
+	uint32_t current = 0;
+};
+
+static const XMFLOAT3 lightPositionA = XMFLOAT3(0, 3, 0);
+static const XMFLOAT3 lightPositionB = XMFLOAT3(100, 3, 0);
+
+static void testStaticScene()
+{
+	SyntheticScene s;
+	wi::ecs::Entity lightA = s.addLight(wi::scene::LightComponent::POINT, lightPositionA, 10.0f);
+	wi::ecs::Entity lightB = s.addLight(wi::scene::LightComponent::SPOT, lightPositionB, 10.0f);
+	s.addCaster(XMFLOAT3(0, 0, 0));
+	s.addCaster(XMFLOAT3(100, 0, 0));
+
+	s.nextFrame();
+	check(s.isDirty(lightA) && s.isDirty(lightB), "static scene", "every light is dirty on the first frame");
+
+	uint32_t moving = s.nextFrame();
+	check(moving == 0, "static scene", "no caster moves");
+	check(s.dirtyLights.empty(), "static scene", "no light is dirty once drawn");
+}
+
+static void testMovingCaster()
+{
+	SyntheticScene s;
+	wi::ecs::Entity lightA = s.addLight(wi::scene::LightComponent::POINT, lightPositionA, 10.0f);
+	wi::ecs::Entity lightB = s.addLight(wi::scene::LightComponent::POINT, lightPositionB, 10.0f);
+	wi::ecs::Entity caster = s.addCaster(XMFLOAT3(2, 0, 0));
+	s.addCaster(XMFLOAT3(100, 0, 0));
+	s.nextFrame();
+
+	s.moveCaster(caster, XMFLOAT3(3, 0, 0));
+	uint32_t moving = s.nextFrame();
+	check(moving == 1, "moving caster", "one caster moves");
+	check(s.isDirty(lightA), "moving caster", "the light reaching the caster is dirty");
+	check(!s.isDirty(lightB), "moving caster", "the far light stays cached");
+
+	//moving out of range still clears the old place
+	s.moveCaster(caster, XMFLOAT3(50, 0, 0));
+	s.nextFrame();
+	check(s.isDirty(lightA), "moving caster", "the light the caster left is dirty");
+	check(!s.isDirty(lightB), "moving caster", "the far light stays cached when the caster leaves the other light");
+
+	s.nextFrame();
+	check(s.dirtyLights.empty(), "moving caster", "nothing is dirty once the caster stops");
+}
+
+static void testMovingLight()
+{
+	SyntheticScene s;
+	wi::ecs::Entity lightA = s.addLight(wi::scene::LightComponent::POINT, lightPositionA, 10.0f);
+	wi::ecs::Entity lightB = s.addLight(wi::scene::LightComponent::POINT, lightPositionB, 10.0f);
+	s.addCaster(XMFLOAT3(0, 0, 0));
+	s.nextFrame();
+
+	s.moveLight(lightB, XMFLOAT3(100, 4, 0));
+	uint32_t moving = s.nextFrame();
+	check(moving == 0, "moving light", "no caster moves");
+	check(s.isDirty(lightB), "moving light", "the moved light is dirty");
+	check(!s.isDirty(lightA), "moving light", "the other light stays cached");
+}
+
+static void testSkinnedCaster()
+{
+	SyntheticScene s;
+	wi::ecs::Entity lightA = s.addLight(wi::scene::LightComponent::POINT, lightPositionA, 10.0f);
+	wi::ecs::Entity lightB = s.addLight(wi::scene::LightComponent::POINT, lightPositionB, 10.0f);
+	s.addCaster(XMFLOAT3(1, 1, 0), true);
+	s.nextFrame();
+
+	//a skinned hand can animate without its bounds changing
+	for (int frame = 0; frame < 3; ++frame)
+	{
+		uint32_t moving = s.nextFrame();
+		check(moving == 1, "skinned caster", "a skinned caster always moves");
+		check(s.isDirty(lightA), "skinned caster", "the light reaching the hand is dirty every frame");
+		check(!s.isDirty(lightB), "skinned caster", "the far light stays cached");
+	}
+}
+
+static void testDirectionalLight()
+{
+	SyntheticScene s;
+	wi::ecs::Entity sun = s.addLight(wi::scene::LightComponent::DIRECTIONAL, XMFLOAT3(0, 0, 0), 0.0f);
+	wi::ecs::Entity lightB = s.addLight(wi::scene::LightComponent::POINT, lightPositionB, 10.0f);
+	s.addCaster(XMFLOAT3(100, 0, 0));
+	s.nextFrame();
+
+	s.nextFrame();
+	check(s.isDirty(sun), "directional light", "directional lights are always dirty");
+	check(!s.isDirty(lightB), "directional light", "point lights stay cached next to a directional light");
+}
+
+static void testAddedAndRemovedCasters()
+{
+	SyntheticScene s;
+	wi::ecs::Entity lightA = s.addLight(wi::scene::LightComponent::POINT, lightPositionA, 10.0f);
+	wi::ecs::Entity lightB = s.addLight(wi::scene::LightComponent::POINT, lightPositionB, 10.0f);
+	s.addCaster(XMFLOAT3(0, 0, 0));
+	wi::ecs::Entity removed = s.addCaster(XMFLOAT3(100, 0, 0));
+	s.addCaster(XMFLOAT3(1, 0, 0));
+	s.nextFrame();
+
+	s.removeCaster(removed);
+	uint32_t moving = s.nextFrame();
+	check(moving == 1, "removed caster", "the removed caster counts as moving");
+	check(s.isDirty(lightB), "removed caster", "the light that drew the removed caster is dirty");
+	check(!s.isDirty(lightA), "removed caster", "casters after the removed one are matched, the other light stays cached");
+
+	s.addCaster(XMFLOAT3(101, 0, 0));
+	moving = s.nextFrame();
+	check(moving == 1, "added caster", "the added caster counts as moving");
+	check(s.isDirty(lightB), "added caster", "the light reaching the added caster is dirty");
+	check(!s.isDirty(lightA), "added caster", "the other light stays cached");
+}
+
+int main()
+{
+	testStaticScene();
+	testMovingCaster();
+	testMovingLight();
+	testSkinnedCaster();
+	testDirectionalLight();
+	testAddedAndRemovedCasters();
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
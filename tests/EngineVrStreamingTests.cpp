@@ -0,0 +1,184 @@
+#include "WickedEngine.h"
+#include "EngineVrStreaming.h"
+
+#include <cstdio>
+#include <functional>
+
+//Prefetch and eviction of EngineVrStreaming driven by a scripted walk over a synthetic chunk grid.
+//The loader never touches files, it only counts what the streaming asked for.
+
+static uint32_t failures = 0;
+
+static void check(bool condition, const char* testName, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED %s : %s\n", testName, message);
+		failures++;
+	}
+}
+
+static const int gridSize = 32;
+//cells of this column are in the manifest without content (zero cost)
+static const int emptyColumn = 5;
+static const uint64_t chunkCost = 1024 * 1024;
+
+class SyntheticChunkLoader : public EngineVrChunkLoader
+{
+public:
+	void getManifest(wi::vector<ChunkInfo>& manifest) override
+	{
+		manifestReads++;
+		for (int x = 0; x < gridSize; ++x)
+		{
+			for (int z = -gridSize / 2; z < gridSize / 2; ++z)
+			{
+				ChunkInfo info;
+				info.x = x;
+				info.z = z;
+				info.cost = x == emptyColumn ? 0 : chunkCost;
+				manifest.push_back(info);
+			}
+		}
+	}
+
+	bool loadChunk(int x, int z, wi::scene::Scene& chunkScene, wi::ecs::Entity& root) override
+	{
+		if (x == emptyColumn)
+		{
+			emptyLoads++;
+		}
+		root = wi::ecs::CreateEntity();
+		loads++;
+		return true;
+	}
+
+	void attachChunk(wi::scene::Scene& chunkScene) override
+	{
+		attaches++;
+	}
+
+	void evictChunk(wi::ecs::Entity root) override
+	{
+		evictions++;
+	}
+
+	uint32_t manifestReads = 0;
+	std::atomic<uint32_t> loads{ 0 };
+	std::atomic<uint32_t> emptyLoads{ 0 };
+	uint32_t attaches = 0;
+	uint32_t evictions = 0;
+};
+
+//Update at 90 Hz and finish the load jobs started by each update, so the results do not depend on the worker timing
+static void walk(EngineVrStreaming& streaming, XMFLOAT3& position, const XMFLOAT3& velocity, float seconds,
+	const std::function<void(uint32_t frame)>& checkFrame)
+{
+	const float dt = 1.0f / 90.0f;
+	for (uint32_t frame = 0; frame < (uint32_t)(seconds / dt); ++frame)
+	{
+		position.x += velocity.x * dt;
+		position.z += velocity.z * dt;
+		streaming.update(position, velocity, dt);
+		streaming.waitForLoads();
+
+		checkFrame(frame);
+	}
+}
+
+static void testPrefetch()
+{
+	EngineVrStreaming streaming;
+	EngineVrStreaming::Settings settings;
+	settings.chunkSize = 32.0f;
+	settings.loadRadius = 48.0f;
+	settings.predictionTime = 2.0f;
+	settings.evictDelay = 1.0f;
+	settings.memoryBudget = 40 * chunkCost;
+	streaming.setSettings(settings);
+
+	std::shared_ptr<SyntheticChunkLoader> loader = std::make_shared<SyntheticChunkLoader>();
+	streaming.setLoader(loader);
+	check(loader->manifestReads == 1, "prefetch", "the manifest is read when the loader is set");
+
+	//walk along +X through the grid, over the empty column
+	XMFLOAT3 position = XMFLOAT3(16, 1.6f, 16);
+	XMFLOAT3 velocity = XMFLOAT3(5, 0, 0);
+	bool aheadResident = true;
+	bool overBudget = false;
+	walk(streaming, position, velocity, 30.0f, [&](uint32_t frame) {
+		//warm up, at most maxConcurrentLoads are started per frame
+		if (frame < 30)
+			return;
+
+		int x = (int)std::floor(position.x / settings.chunkSize);
+		int z = (int)std::floor(position.z / settings.chunkSize);
+		int aheadX = (int)std::floor((position.x + velocity.x * settings.predictionTime) / settings.chunkSize);
+		for (int cellX : { x, aheadX })
+		{
+			if (cellX != emptyColumn && cellX < gridSize && !streaming.isChunkResident(cellX, z))
+			{
+				aheadResident = false;
+			}
+		}
+		overBudget = overBudget || streaming.getStats().residentBytes > settings.memoryBudget;
+	});
+
+	check(aheadResident, "prefetch", "the current and predicted chunks are resident before the player reaches them");
+	check(!overBudget, "prefetch", "the resident chunks stay within the memory budget");
+	check(loader->emptyLoads.load() == 0, "prefetch", "zero cost cells of the manifest are never loaded");
+	check(loader->evictions > 0 && streaming.getStats().evictions == loader->evictions, "prefetch", "chunks left behind are evicted");
+	check(loader->manifestReads == 1, "prefetch", "the frame updates never ask the loader for sizes");
+
+	streaming.clear();
+	check(streaming.getStats().residentChunks == 0 && loader->attaches == loader->evictions, "prefetch", "clear evicts every resident chunk");
+
+	//the manifest survives clear, a new session streams again without reading it
+	position = XMFLOAT3(16, 1.6f, 16);
+	walk(streaming, position, XMFLOAT3(0, 0, 0), 1.0f, [](uint32_t frame) {});
+	check(streaming.isChunkResident(0, 0), "prefetch", "chunks load again after clear");
+	check(loader->manifestReads == 1, "prefetch", "clear keeps the manifest");
+}
+
+static void testBudget()
+{
+	EngineVrStreaming streaming;
+	EngineVrStreaming::Settings settings;
+	settings.chunkSize = 32.0f;
+	settings.loadRadius = 48.0f;
+	settings.memoryBudget = 4 * chunkCost;
+	streaming.setSettings(settings);
+
+	std::shared_ptr<SyntheticChunkLoader> loader = std::make_shared<SyntheticChunkLoader>();
+	streaming.setLoader(loader);
+
+	XMFLOAT3 position = XMFLOAT3(80, 1.6f, 16);
+	bool overBudget = false;
+	walk(streaming, position, XMFLOAT3(0, 0, 0), 2.0f, [&](uint32_t frame) {
+		overBudget = overBudget || streaming.getStats().residentBytes > settings.memoryBudget;
+	});
+
+	check(!overBudget, "budget", "a budget smaller than the range is never exceeded");
+	check(streaming.getStats().residentChunks == 4, "budget", "the budget is filled");
+	check(streaming.getStats().budgetStalls > 0, "budget", "loads wait when in range chunks fill the budget");
+	check(streaming.getStats().evictions == 0, "budget", "in range chunks are not evicted to make room");
+}
+
+int main()
+{
+	wi::jobsystem::Initialize();
+
+	testPrefetch();
+	testBudget();
+
+	wi::jobsystem::ShutDown();
+
+	if (failures > 0)
+	{
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}